@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "Notification.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+/**
+ * @file NotificationBenchmark.cpp
+ * @brief On-target throughput and wake latency benchmarks
+ * 
+ * Run on real ESP32 hardware by calling runNotificationBenchmark() once from
+ * setup()/app_main(). Every result is printed as one JSON object per line,
+ * prefixed with "BENCH ", so a host script can grep and compare runs:
+ * 
+ *   BENCH {"bench":"roundtrip","cores":"cross","iterations":1000,"avg_us":41.2,...}
+ * 
+ * Only the string-key send/consume/signal API is used, so the same file builds
+ * against older releases of the library for before/after comparisons.
+ * The 1000-key case needs -DNOTIFICATION_MAX_KEYS=2048 and is skipped otherwise,
+ * since keys are spread over shards by hash and the table needs some headroom.
+ * Keys stay in the table once used, so later cases reuse earlier names rather
+ * than adding more. A case whose sends fail reports "failed" instead of timings.
+ */
+
+static const int PAIR_ITERATIONS = 10000;
+static const int ROUNDTRIP_ITERATIONS = 1000;
+static const uint32_t SCALING_MS = 2000;
+static const int HEAP_ROUNDS = 10;
+static const int HEAP_KEYS = 10;        // The smallest live-keys case, so these names exist
+
+static Notification* bench = nullptr;
+static SemaphoreHandle_t benchDone = nullptr;
+static volatile bool benchRunning = false;
+
+/**
+ * @brief Print free and largest free block of the default heap
+ */
+static void benchHeap(const char* phase) {
+    printf("BENCH {\"bench\":\"heap\",\"phase\":\"%s\",\"free\":%u,\"largest_block\":%u,\"min_free\":%u}\n",
+           phase,
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+}
+
+/**
+ * @brief send/consume pairs per second from a single task, no contention
+ */
+static void benchPairs() {
+    static int value = 0;
+    int failed = 0;
+    
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < PAIR_ITERATIONS; i++) {
+        failed += bench->send("bench_pair", &value) ? 0 : 1;
+        bench->consume("bench_pair", 0);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    
+    if (failed > 0) {
+        printf("BENCH {\"bench\":\"pairs\",\"iterations\":%d,\"failed\":%d}\n", PAIR_ITERATIONS, failed);
+        return;
+    }
+    printf("BENCH {\"bench\":\"pairs\",\"iterations\":%d,\"total_us\":%lld,\"pairs_per_sec\":%.0f}\n",
+           PAIR_ITERATIONS, (long long)elapsed, PAIR_ITERATIONS * 1e6 / (double)elapsed);
+}
+
+/**
+ * @brief Answers every ping with a pong
+ */
+static void pongTask(void* param) {
+    int count = (int)(intptr_t)param;
+    
+    // Bounded waits, so a ping that never went out can't strand this task past the run
+    for (int i = 0; i < count && benchRunning; ) {
+        int value = bench->signal("bench_ping", pdMS_TO_TICKS(100));
+        if (value != -1) {
+            bench->send("bench_pong", value);
+            i++;
+        }
+    }
+    
+    xSemaphoreGive(benchDone);
+    vTaskDelete(nullptr);
+}
+
+/**
+ * @brief Ping-pong round trip between this task (core 0) and a task on pong_core
+ */
+static void benchRoundTrip(const char* cores, BaseType_t pong_core) {
+    benchRunning = true;
+    xTaskCreatePinnedToCore(pongTask, "bench_pong", 4096, (void*)(intptr_t)ROUNDTRIP_ITERATIONS,
+                            5, nullptr, pong_core);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    
+    int64_t total = 0;
+    int64_t best = INT64_MAX;
+    int64_t worst = 0;
+    int lost = 0;
+    int failed = 0;
+    
+    for (int i = 0; i < ROUNDTRIP_ITERATIONS; i++) {
+        int64_t start = esp_timer_get_time();
+        if (!bench->send("bench_ping", i)) {
+            failed++;
+            continue;
+        }
+        if (bench->signal("bench_pong", pdMS_TO_TICKS(1000)) != i) {
+            lost++;
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        
+        total += elapsed;
+        best = elapsed < best ? elapsed : best;
+        worst = elapsed > worst ? elapsed : worst;
+    }
+    
+    // The pong task touches bench until it checks in, so wait for it however long it takes
+    benchRunning = false;
+    xSemaphoreTake(benchDone, portMAX_DELAY);
+    bench->clear();     // A late pong would otherwise answer the next run's first ping
+    
+    if (failed > 0) {
+        printf("BENCH {\"bench\":\"roundtrip\",\"cores\":\"%s\",\"iterations\":%d,\"failed\":%d}\n",
+               cores, ROUNDTRIP_ITERATIONS, failed);
+        return;
+    }
+    printf("BENCH {\"bench\":\"roundtrip\",\"cores\":\"%s\",\"iterations\":%d,"
+           "\"avg_us\":%.1f,\"min_us\":%lld,\"max_us\":%lld,\"lost\":%d}\n",
+           cores, ROUNDTRIP_ITERATIONS, total / (double)ROUNDTRIP_ITERATIONS,
+           (long long)best, (long long)worst, lost);
+}
+
+struct ScalingWorker {
+    char key[16];
+    uint32_t operations;
+};
+
+static void scalingProducer(void* param) {
+    ScalingWorker* worker = (ScalingWorker*)param;
+    int value = 0;
+    
+    while (benchRunning) {
+        if (bench->send(worker->key, value++)) {
+            worker->operations++;
+        }
+        taskYIELD();
+    }
+    
+    xSemaphoreGive(benchDone);
+    vTaskDelete(nullptr);
+}
+
+static void scalingConsumer(void* param) {
+    ScalingWorker* worker = (ScalingWorker*)param;
+    
+    while (benchRunning) {
+        if (bench->signal(worker->key, pdMS_TO_TICKS(10)) != -1) {
+            worker->operations++;
+        }
+    }
+    
+    xSemaphoreGive(benchDone);
+    vTaskDelete(nullptr);
+}
+
+/**
+ * @brief Throughput with N producer/consumer pairs, one key per pair, on both cores
+ */
+static void benchScaling(int pairs) {
+    ScalingWorker* producers = (ScalingWorker*)calloc(pairs, sizeof(ScalingWorker));
+    ScalingWorker* consumers = (ScalingWorker*)calloc(pairs, sizeof(ScalingWorker));
+    if (producers == nullptr || consumers == nullptr) {
+        printf("BENCH {\"bench\":\"scaling\",\"pairs\":%d,\"error\":\"out of memory\"}\n", pairs);
+        free(producers);
+        free(consumers);
+        return;
+    }
+    
+    benchRunning = true;
+    for (int i = 0; i < pairs; i++) {
+        snprintf(producers[i].key, sizeof(producers[i].key), "bench_s%d", i);
+        memcpy(consumers[i].key, producers[i].key, sizeof(consumers[i].key));
+        xTaskCreate(scalingProducer, "bench_prod", 3072, &producers[i], 4, nullptr);
+        xTaskCreate(scalingConsumer, "bench_cons", 3072, &consumers[i], 4, nullptr);
+    }
+    
+    vTaskDelay(pdMS_TO_TICKS(SCALING_MS));
+    benchRunning = false;
+    
+    // Workers write to the arrays until they check in, so they can't be freed before
+    for (int i = 0; i < pairs * 2; i++) {
+        xSemaphoreTake(benchDone, portMAX_DELAY);
+    }
+    
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    for (int i = 0; i < pairs; i++) {
+        sent += producers[i].operations;
+        received += consumers[i].operations;
+    }
+    
+    printf("BENCH {\"bench\":\"scaling\",\"pairs\":%d,\"duration_ms\":%lu,"
+           "\"sends_per_sec\":%.0f,\"consumes_per_sec\":%.0f}\n",
+           pairs, (unsigned long)SCALING_MS,
+           sent * 1000.0 / SCALING_MS, received * 1000.0 / SCALING_MS);
+    
+    bench->clear();
+    free(producers);
+    free(consumers);
+}
+
+/**
+ * @brief send/consume cost with N other keys live in the store
+ */
+static void benchLiveKeys(int keys) {
+#ifdef NOTIFICATION_MAX_KEYS
+    if (keys * 2 > NOTIFICATION_MAX_KEYS) {
+        printf("BENCH {\"bench\":\"live_keys\",\"keys\":%d,\"skipped\":\"NOTIFICATION_MAX_KEYS=%d\"}\n",
+               keys, NOTIFICATION_MAX_KEYS);
+        return;
+    }
+#endif
+    
+    char (*names)[16] = (char (*)[16])malloc(keys * 16);
+    if (names == nullptr) {
+        printf("BENCH {\"bench\":\"live_keys\",\"keys\":%d,\"error\":\"out of memory\"}\n", keys);
+        return;
+    }
+    
+    static int value = 0;
+    int failed = 0;
+    for (int i = 0; i < keys; i++) {
+        snprintf(names[i], 16, "bench_k%d", i);
+        failed += bench->send(names[i], &value) ? 0 : 1;
+    }
+    
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; failed == 0 && i < PAIR_ITERATIONS; i++) {
+        const char* key = names[i % keys];
+        bench->consume(key, 0);
+        failed += bench->send(key, &value) ? 0 : 1;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    
+    if (failed > 0) {
+        // Usually a full key shard, the timing would only measure the error path
+        printf("BENCH {\"bench\":\"live_keys\",\"keys\":%d,\"failed\":%d}\n", keys, failed);
+    } else {
+        printf("BENCH {\"bench\":\"live_keys\",\"keys\":%d,\"iterations\":%d,\"ns_per_pair\":%.0f}\n",
+               keys, PAIR_ITERATIONS, elapsed * 1000.0 / PAIR_ITERATIONS);
+    }
+    
+    bench->clear();
+    free(names);
+}
+
+/**
+ * @brief Heap use and fragmentation across repeated send/consume/clear rounds
+ * 
+ * Cycles through the live-key names, which are already in the table, so the
+ * rounds measure item churn and not the table filling up.
+ */
+static void benchHeapRounds() {
+    static int value = 0;
+    char key[16];
+    
+    for (int round = 0; round < HEAP_ROUNDS; round++) {
+        int failed = 0;
+        for (int i = 0; i < 1000; i++) {
+            snprintf(key, sizeof(key), "bench_k%d", i % HEAP_KEYS);
+            failed += bench->send(key, &value) ? 0 : 1;
+            if (i % 3 == 0) {
+                bench->consume(key, 0);
+            }
+        }
+        bench->clear();
+        
+        if (failed > 0) {
+            printf("BENCH {\"bench\":\"heap_round\",\"round\":%d,\"failed\":%d}\n", round, failed);
+            continue;
+        }
+        printf("BENCH {\"bench\":\"heap_round\",\"round\":%d,\"free\":%u,\"largest_block\":%u}\n",
+               round,
+               (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+               (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    }
+}
+
+/**
+ * @brief Runs every benchmark in order, then deletes itself
+ */
+static void benchmarkTask(void*) {
+    benchHeap("start");
+    
+    bench = new Notification();
+    benchDone = xSemaphoreCreateCounting(64, 0);
+    benchHeap("initialized");
+    
+    benchPairs();
+    benchRoundTrip("same", 0);
+    benchRoundTrip("cross", 1);
+    
+    const int scaling[] = {1, 4, 16};
+    for (int pairs : scaling) {
+        benchScaling(pairs);
+    }
+    
+    const int liveKeys[] = {10, 100, 1000};
+    for (int keys : liveKeys) {
+        benchLiveKeys(keys);
+    }
+    
+    benchHeapRounds();
+    benchHeap("end");
+    
+    delete bench;
+    bench = nullptr;
+    vSemaphoreDelete(benchDone);
+    benchHeap("destroyed");
+    
+    printf("BENCH {\"bench\":\"done\"}\n");
+    vTaskDelete(nullptr);
+}
+
+/**
+ * @brief Start the benchmark suite on core 0
+ */
+void runNotificationBenchmark() {
+    xTaskCreatePinnedToCore(benchmarkTask, "bench", 6144, nullptr, 5, nullptr, 0);
+}
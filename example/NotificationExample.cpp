@@ -1,4 +1,7 @@
 #include "Notification.h"
+#include "NotificationPool.h"
+#include "TypedChannel.h"
+#include "NotificationKeys.h"
 
 /**
  * @file NotificationExample.cpp
@@ -11,6 +14,13 @@
 // Global notification instance
 Notification* notification = nullptr;
 
+// Keys known at build time - handles and slots are computed by the compiler
+#define CLIMATE_KEYS(KEY) \
+    KEY(setpoint, float) \
+    KEY(fan_speed, int)
+
+NOTIFY_KEY_TABLE(ClimateKeys, CLIMATE_KEYS);
+
 /**
  * @brief Example of sending different types of data (FreeRTOS style)
  */
@@ -106,6 +116,105 @@ void exampleConsumeNotifications() {
     }
 }
 
+/**
+ * @brief Example of small structs sent by value
+ */
+void exampleTypedChannel() {
+    if (!notification) return;
+    
+    struct SensorData {
+        int id;
+        float value;
+        uint32_t timestamp;
+    };
+    
+    // The struct is copied into the slot - no static storage needed
+    TypedChannel<SensorData> sensor(*notification, "typed_sensor");
+    SensorData reading = {2, 19.8f, (uint32_t)(esp_timer_get_time() / 1000)};
+    bool success = sensor.send(reading);
+    ESP_LOGI("Example", "Send typed sensor: %s", success ? "OK" : "FAILED");
+    
+    if (auto received = sensor.consume()) {
+        ESP_LOGI("Example", "Consumed typed sensor - ID: %d, Value: %.1f",
+                 received->id, received->value);
+    }
+}
+
+/**
+ * @brief Example of compile-time keys with checked payload types
+ */
+void exampleStaticKeys() {
+    if (!notification) return;
+    
+    // No lookup at all, the handle is a constant
+    bool success = ClimateKeys::setpoint.send(*notification, 21.5f);
+    ESP_LOGI("Example", "Send setpoint: %s", success ? "OK" : "FAILED");
+    
+    // ClimateKeys::setpoint.send(*notification, 21) would not compile
+    if (std::optional<float> setpoint = ClimateKeys::setpoint.consume(*notification)) {
+        ESP_LOGI("Example", "Consumed setpoint: %.1f", *setpoint);
+    }
+}
+
+/**
+ * @brief Example of pooled buffers with ownership transfer
+ */
+void examplePooledBuffers() {
+    if (!notification) return;
+    
+    // One allocation at startup, none afterwards
+    static NotificationPool bufferPool(100, 8);
+    notification->attachPool(&bufferPool);
+    notification->setQueueMode("pooled_buffer", 4);
+    
+    // Producer: acquire a block and hand it over
+    for (int i = 0; i < 6; i++) {
+        uint8_t* buffer = (uint8_t*)bufferPool.acquire();
+        if (buffer) {
+            memset(buffer, i, 100);
+            // Once the queue is full, the oldest block goes back to the pool
+            notification->send("pooled_buffer", buffer);
+        }
+    }
+    ESP_LOGI("Example", "Pool blocks free after sends: %zu", bufferPool.available());
+    
+    // Consumer: use the block, then release it
+    void* data;
+    while ((data = notification->consume("pooled_buffer", 0)) != nullptr) {
+        uint8_t* buffer = (uint8_t*)data;
+        ESP_LOGI("Example", "Consumed pooled buffer - first byte: 0x%02X", buffer[0]);
+        notification->release(buffer);
+    }
+    ESP_LOGI("Example", "Pool blocks free after consume: %zu", bufferPool.available());
+}
+
+/**
+ * @brief Handler called for every "alarm" item - no consumer task needed
+ */
+void onAlarm(const NotificationEvent& event, void* ctx) {
+    const char* source = (const char*)ctx;
+    ESP_LOGI("Example", "Alarm from %s - code: %d", source, event.signal);
+}
+
+/**
+ * @brief Example of handler dispatch
+ */
+void exampleSubscribe() {
+    if (!notification) return;
+    
+    static const char* source = "door sensor";
+    
+    // Deferred: the handler runs on the shared dispatcher pool
+    notification->setQueueMode("alarm", 4);
+    notification->subscribe("alarm", onAlarm, (void*)source);
+    notification->send("alarm", 17);
+    notification->send("alarm", 18);
+    
+    // Inline: the handler runs in this task, before send() returns
+    notification->subscribe("alarm_inline", onAlarm, (void*)source, NotificationDispatch::Inline);
+    notification->send("alarm_inline", 42);
+}
+
 /**
  * @brief Example of notification management
  */
@@ -206,12 +315,25 @@ void initNotificationExample() {
         return;
     }
     
+    // Before any string key is sent, so the table's home slots are still free
+    if (!ClimateKeys::install(*notification)) {
+        ESP_LOGE("Example", "Failed to install climate keys");
+    }
+    
     // Run basic examples
     ESP_LOGI("Example", "=== Running basic notification examples ===");
     exampleSendNotifications();
     vTaskDelay(pdMS_TO_TICKS(100));
     exampleConsumeNotifications();
     vTaskDelay(pdMS_TO_TICKS(100));
+    examplePooledBuffers();
+    vTaskDelay(pdMS_TO_TICKS(100));
+    exampleTypedChannel();
+    vTaskDelay(pdMS_TO_TICKS(100));
+    exampleStaticKeys();
+    vTaskDelay(pdMS_TO_TICKS(100));
+    exampleSubscribe();
+    vTaskDelay(pdMS_TO_TICKS(100));
     exampleNotificationManagement();
     
     // Create producer and consumer tasks for advanced example
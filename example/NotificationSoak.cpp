@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include "Notification.h"
+#include "NotificationPool.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+/**
+ * @file NotificationSoak.cpp
+ * @brief Long-running soak test and per-key memory footprint report
+ * 
+ * Run on real ESP32 hardware by calling runNotificationSoak(minutes) once from
+ * setup()/app_main(), with nothing else allocating meanwhile. It first prints the
+ * RAM cost of each storage mode, then runs randomized send/consume/remove/clear
+ * traffic from one task per core and samples the heap every minute. Results are
+ * printed as one JSON object per line, prefixed with "SOAK ":
+ * 
+ *   SOAK {"soak":"footprint","mode":"queue","depth":16,"keys":4,"heap_per_key":...}
+ *   SOAK {"soak":"sample","minute":60,"free":...,"largest_block":...,"ops":...}
+ *   SOAK {"soak":"result","minutes":240,"free_drift":0,"largest_drift":0,"flat":true,...}
+ * 
+ * Pointer payloads come from an attached NotificationPool, so every block that
+ * is overwritten, rejected, removed or cleared has to find its way back; the
+ * result line checks that too. "flat" is true when neither the free heap nor
+ * the largest free block dropped more than SOAK_TOLERANCE below the level seen
+ * after the warm-up.
+ */
+
+static const int FOOTPRINT_KEYS = 4;
+static const int SOAK_KEYS = 16;
+static const int SOAK_POOL_BLOCKS = 64;
+static const size_t SOAK_BLOCK_SIZE = 32;
+static const uint32_t SOAK_WARMUP_MS = 60 * 1000;
+static const uint32_t SOAK_SAMPLE_MS = 60 * 1000;
+static const size_t SOAK_TOLERANCE = 256;
+
+static Notification* soak = nullptr;
+static NotificationPool* soakPool = nullptr;
+static NotificationKey soakHandles[SOAK_KEYS];
+static char soakNames[SOAK_KEYS][16];
+static SemaphoreHandle_t soakDone = nullptr;
+static volatile bool soakRunning = false;
+
+struct SoakWorker {
+    uint32_t state;             // xorshift32, seeded from the start time
+    uint32_t ops;
+    uint32_t poolEmpty;         // Sends skipped because every block was in flight
+};
+
+static size_t heapFree() {
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+static size_t heapLargest() {
+    return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
+
+static uint32_t soakRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/**
+ * @brief Heap cost of FOOTPRINT_KEYS keys in one storage mode, on a fresh instance
+ */
+static void footprintMode(const char* mode, int depth) {
+    Notification* n = new Notification();
+    char key[16];
+    int failed = 0;
+    
+    size_t before = heapFree();
+    for (int i = 0; i < FOOTPRINT_KEYS; i++) {
+        snprintf(key, sizeof(key), "fp_%d", i);
+        bool ok;
+        if (strcmp(mode, "signal") == 0) {
+            ok = n->registerSignalKey(key).valid() && n->send(key, i);
+        } else if (strcmp(mode, "queue") == 0) {
+            ok = n->setQueueMode(key, depth) && n->send(key, i);
+        } else if (strcmp(mode, "broadcast") == 0) {
+            ok = n->setBroadcastMode(key, depth) && n->send(key, i);
+        } else {
+            ok = n->send(key, i);
+        }
+        failed += ok ? 0 : 1;
+    }
+    size_t after = heapFree();
+    
+    printf("SOAK {\"soak\":\"footprint\",\"mode\":\"%s\",\"depth\":%d,\"keys\":%d,"
+           "\"heap_per_key\":%.1f,\"failed\":%d}\n",
+           mode, depth, FOOTPRINT_KEYS, ((double)before - (double)after) / FOOTPRINT_KEYS, failed);
+    
+    delete n;
+}
+
+/**
+ * @brief RAM cost of the instance, each storage mode and a payload pool
+ */
+static void soakFootprint() {
+    size_t before = heapFree();
+    Notification* n = new Notification();
+    size_t after = heapFree();
+    delete n;
+    
+    // The key table lives inside the instance, so every mode pays this per slot
+    printf("SOAK {\"soak\":\"footprint\",\"mode\":\"instance\",\"sizeof\":%u,\"heap\":%u,"
+           "\"max_keys\":%d,\"table_per_key\":%.1f}\n",
+           (unsigned)sizeof(Notification), (unsigned)(before - after), NOTIFICATION_MAX_KEYS,
+           sizeof(Notification) / (double)NOTIFICATION_MAX_KEYS);
+    
+    footprintMode("latest", 1);
+    footprintMode("signal", 1);
+    footprintMode("queue", 4);
+    footprintMode("queue", 16);
+    footprintMode("broadcast", 8);
+    
+    before = heapFree();
+    NotificationPool* pool = new NotificationPool(SOAK_BLOCK_SIZE, SOAK_POOL_BLOCKS);
+    after = heapFree();
+    printf("SOAK {\"soak\":\"footprint\",\"mode\":\"pool\",\"block_size\":%u,\"blocks\":%d,\"heap\":%u}\n",
+           (unsigned)SOAK_BLOCK_SIZE, SOAK_POOL_BLOCKS, (unsigned)(before - after));
+    delete pool;
+}
+
+/**
+ * @brief Drop whatever a consume handed over, whichever type it was
+ */
+static void soakConsume(int k) {
+    void* data;
+    NotificationStatus status = soak->tryConsume(soakHandles[k], data);
+    if (status == NotificationStatus::Ok) {
+        soak->release(data);
+        return;
+    }
+    if (status != NotificationStatus::Rejected) {
+        return;
+    }
+    
+    // Something other than a pointer is at the head
+    int signal;
+    if (soak->tryConsume(soakHandles[k], signal) != NotificationStatus::Rejected) {
+        return;
+    }
+    uint32_t value;
+    soak->consumeValue(soakHandles[k], &value, sizeof(value), 0);
+}
+
+/**
+ * @brief Random mix of operations on the shared keys until soakRunning drops
+ */
+static void soakWorker(void* param) {
+    SoakWorker* worker = (SoakWorker*)param;
+    
+    while (soakRunning) {
+        uint32_t r = soakRandom(worker->state);
+        int k = r % SOAK_KEYS;
+        uint32_t op = (r >> 8) % 1000;
+        
+        if (op < 350) {
+            void* block = soakPool->acquire();
+            if (block != nullptr) {
+                // Rejected sends release the block, so nothing to check
+                soak->send(soakNames[k], block);
+            } else {
+                worker->poolEmpty++;
+            }
+        } else if (op < 450) {
+            soak->send(soakHandles[k], (int)(r >> 16));
+        } else if (op < 500) {
+            uint32_t value = r;
+            soak->sendValue(soakHandles[k], &value, sizeof(value));
+        } else if (op < 950) {
+            soakConsume(k);
+        } else if (op < 999) {
+            soak->remove(soakNames[k]);
+        } else {
+            soak->clear();
+        }
+        
+        // Let the idle task run, the task watchdog is watching it
+        if (++worker->ops % 256 == 0) {
+            vTaskDelay(1);
+        }
+    }
+    
+    xSemaphoreGive(soakDone);
+    vTaskDelete(nullptr);
+}
+
+/**
+ * @brief Keys in every consumable storage mode, shared by both workers
+ */
+static void soakSetup() {
+    soakPool = new NotificationPool(SOAK_BLOCK_SIZE, SOAK_POOL_BLOCKS);
+    soak->attachPool(soakPool);
+    
+    for (int k = 0; k < SOAK_KEYS; k++) {
+        snprintf(soakNames[k], sizeof(soakNames[k]), "soak_%d", k);
+        switch (k % 4) {
+        case 0:
+            soakHandles[k] = soak->registerKey(soakNames[k]);
+            break;
+        case 1:
+            soak->setQueueMode(soakNames[k], 4, NotificationOverflow::DropOldest);
+            soakHandles[k] = soak->registerKey(soakNames[k]);
+            break;
+        case 2:
+            soak->setQueueMode(soakNames[k], 8, NotificationOverflow::DropNewest);
+            soakHandles[k] = soak->registerKey(soakNames[k]);
+            break;
+        case 3:
+            // Pointer and value sends are rejected here, which exercises the release path
+            soakHandles[k] = soak->registerSignalKey(soakNames[k]);
+            break;
+        }
+    }
+}
+
+static void soakSample(const char* phase, uint32_t minute, const SoakWorker* workers) {
+    printf("SOAK {\"soak\":\"%s\",\"minute\":%lu,\"free\":%u,\"largest_block\":%u,\"min_free\":%u,"
+           "\"pending\":%u,\"pool_available\":%u,\"ops\":%lu}\n",
+           phase, (unsigned long)minute, (unsigned)heapFree(), (unsigned)heapLargest(),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), (unsigned)soak->count(),
+           (unsigned)soakPool->available(), (unsigned long)(workers[0].ops + workers[1].ops));
+}
+
+/**
+ * @brief Footprint report, then the soak itself, then deletes itself
+ */
+static void soakTask(void* param) {
+    uint32_t minutes = (uint32_t)(uintptr_t)param;
+    
+    soakFootprint();
+    
+    soak = new Notification();
+    soakDone = xSemaphoreCreateCounting(2, 0);
+    soakSetup();
+    
+    static SoakWorker workers[2];
+    uint32_t seed = (uint32_t)esp_timer_get_time() | 1;
+    printf("SOAK {\"soak\":\"start\",\"minutes\":%lu,\"seed\":%lu,\"keys\":%d}\n",
+           (unsigned long)minutes, (unsigned long)seed, SOAK_KEYS);
+    
+    soakRunning = true;
+    for (int i = 0; i < 2; i++) {
+        workers[i] = {seed * (i + 1), 0, 0};
+        xTaskCreatePinnedToCore(soakWorker, "soak_worker", 4096, &workers[i], 4, nullptr, i);
+    }
+    
+    // Rings, pool and driver buffers settle during the warm-up, later drift is a leak
+    vTaskDelay(pdMS_TO_TICKS(SOAK_WARMUP_MS));
+    size_t baseFree = heapFree();
+    size_t baseLargest = heapLargest();
+    size_t lowFree = baseFree;
+    size_t lowLargest = baseLargest;
+    soakSample("baseline", 0, workers);
+    
+    for (uint32_t minute = 1; minute <= minutes; minute++) {
+        vTaskDelay(pdMS_TO_TICKS(SOAK_SAMPLE_MS));
+        size_t freeNow = heapFree();
+        size_t largest = heapLargest();
+        lowFree = freeNow < lowFree ? freeNow : lowFree;
+        lowLargest = largest < lowLargest ? largest : lowLargest;
+        soakSample("sample", minute, workers);
+    }
+    
+    soakRunning = false;
+    for (int i = 0; i < 2; i++) {
+        xSemaphoreTake(soakDone, pdMS_TO_TICKS(5000));
+    }
+    
+    // With nothing pending every block has to be back in the pool
+    soak->clear();
+    bool poolIntact = soakPool->available() == soakPool->capacity();
+    long freeDrift = (long)baseFree - (long)lowFree;
+    long largestDrift = (long)baseLargest - (long)lowLargest;
+    bool flat = freeDrift <= (long)SOAK_TOLERANCE && largestDrift <= (long)SOAK_TOLERANCE;
+    
+    printf("SOAK {\"soak\":\"result\",\"minutes\":%lu,\"ops\":%lu,\"pool_empty\":%lu,"
+           "\"free_drift\":%ld,\"largest_drift\":%ld,\"pool_intact\":%s,\"flat\":%s}\n",
+           (unsigned long)minutes, (unsigned long)(workers[0].ops + workers[1].ops),
+           (unsigned long)(workers[0].poolEmpty + workers[1].poolEmpty),
+           freeDrift, largestDrift, poolIntact ? "true" : "false", flat && poolIntact ? "true" : "false");
+    
+    delete soak;
+    soak = nullptr;
+    delete soakPool;
+    soakPool = nullptr;
+    vSemaphoreDelete(soakDone);
+    
+    printf("SOAK {\"soak\":\"done\"}\n");
+    vTaskDelete(nullptr);
+}
+
+/**
+ * @brief Start the footprint report and a soak of the given length on core 0
+ * 
+ * @param minutes Soak duration after the one minute warm-up, e.g. 8 * 60 overnight
+ */
+void runNotificationSoak(uint32_t minutes) {
+    xTaskCreatePinnedToCore(soakTask, "soak", 6144, (void*)(uintptr_t)minutes, 5, nullptr, 0);
+}
@@ -1,249 +1,3451 @@
 #include "Notification.h"
+#include <string.h>
+#include <new>
+#include "esp_attr.h"
+#include "NotificationPool.h"
+#include "NotificationMemory.h"
+#if NOTIFICATION_ENABLE_TRACE || (NOTIFICATION_PERSIST_KEYS > 0 && NOTIFICATION_PERSIST_STORE == NOTIFICATION_PERSIST_NVS)
+#include <stdio.h>
+#endif
+#if NOTIFICATION_PERSIST_KEYS > 0 && NOTIFICATION_PERSIST_STORE == NOTIFICATION_PERSIST_NVS
+#include "nvs.h"
+#endif
+#if NOTIFICATION_TRACE_SYSVIEW
+#include "SEGGER_SYSVIEW.h"
+#endif
+
+static_assert((NOTIFICATION_MAX_KEYS & (NOTIFICATION_MAX_KEYS - 1)) == 0,
+              "NOTIFICATION_MAX_KEYS must be a power of two");
+static_assert(NOTIFICATION_INLINE_PAYLOAD_SIZE <= UINT8_MAX,
+              "NOTIFICATION_INLINE_PAYLOAD_SIZE must fit in a byte");
+static_assert((NOTIFICATION_ISR_QUEUE_LEN & (NOTIFICATION_ISR_QUEUE_LEN - 1)) == 0,
+              "NOTIFICATION_ISR_QUEUE_LEN must be a power of two");
+static_assert((NOTIFICATION_SHARDS & (NOTIFICATION_SHARDS - 1)) == 0 && NOTIFICATION_SHARDS <= 32,
+              "NOTIFICATION_SHARDS must be a power of two, at most 32");
+static_assert(NOTIFICATION_SHARDS <= NOTIFICATION_MAX_KEYS,
+              "NOTIFICATION_SHARDS can't exceed NOTIFICATION_MAX_KEYS");
+static_assert(NOTIFICATION_MAX_KEYS <= 0x8000, "NOTIFICATION_MAX_KEYS can't exceed 32768");
+static_assert(NOTIFICATION_MAX_PATTERNS <= 32, "NOTIFICATION_MAX_PATTERNS can't exceed 32");
+static_assert(NOTIFICATION_MAX_PATTERN_NODES > 1 && NOTIFICATION_MAX_PATTERN_NODES <= UINT8_MAX,
+              "NOTIFICATION_MAX_PATTERN_NODES must be between 2 and 255");
+static_assert((NOTIFICATION_TTL_WHEEL_SIZE & (NOTIFICATION_TTL_WHEEL_SIZE - 1)) == 0,
+              "NOTIFICATION_TTL_WHEEL_SIZE must be a power of two");
+
+static_assert(NOTIFICATION_NOTIFY_INDEX >= 0 && NOTIFICATION_NOTIFY_INDEX < configTASK_NOTIFICATION_ARRAY_ENTRIES,
+              "NOTIFICATION_NOTIFY_INDEX must be lower than configTASK_NOTIFICATION_ARRAY_ENTRIES");
+
+#if NOTIFICATION_STATIC_ALLOCATION && !configSUPPORT_STATIC_ALLOCATION
+#error "NOTIFICATION_STATIC_ALLOCATION needs configSUPPORT_STATIC_ALLOCATION"
+#endif
+static_assert(NOTIFICATION_STATIC_QUEUE_ITEMS <= UINT16_MAX,
+              "NOTIFICATION_STATIC_QUEUE_ITEMS must fit in 16 bits");
+static_assert(NOTIFICATION_PERSIST_KEYS <= UINT8_MAX, "NOTIFICATION_PERSIST_KEYS can't exceed 255");
+static_assert((NOTIFICATION_TRACE_EVENTS & (NOTIFICATION_TRACE_EVENTS - 1)) == 0,
+              "NOTIFICATION_TRACE_EVENTS must be a power of two");
+#if NOTIFICATION_TRACE_SYSVIEW && !NOTIFICATION_ENABLE_TRACE
+#error "NOTIFICATION_TRACE_SYSVIEW needs NOTIFICATION_ENABLE_TRACE"
+#endif
+static_assert(NOTIFICATION_MAX_REQUESTS > 0 && NOTIFICATION_MAX_REQUESTS <= 256,
+              "NOTIFICATION_MAX_REQUESTS must be between 1 and 256, its index is the token's low byte");
+
+#if NOTIFICATION_TRACE_SYSVIEW
+// Event ids follow NotificationTraceType
+static SEGGER_SYSVIEW_MODULE traceModule = {
+    "M=Notification, 0 Send key=%u core=%u, 1 SendFromISR key=%u core=%u, 2 Consume key=%u core=%u, "
+    "3 WaitStart key=%u core=%u, 4 Wake key=%u core=%u, 5 Timeout key=%u core=%u, 6 Lock shard=%u core=%u",
+    7, 0, nullptr, nullptr
+};
+#endif
+
+// Width of one expiry wheel bucket, at least a tick
+static const TickType_t TTL_RESOLUTION =
+    pdMS_TO_TICKS(NOTIFICATION_TTL_RESOLUTION_MS) > 0 ? pdMS_TO_TICKS(NOTIFICATION_TTL_RESOLUTION_MS) : 1;
 
 const char* Notification::TAG = "Notification";
 
+#if NOTIFICATION_PERSIST_KEYS > 0 && NOTIFICATION_PERSIST_STORE == NOTIFICATION_PERSIST_RTC
+// Survives deep sleep and software resets; each record carries its own checksum
+// since a cold boot leaves this memory random
+RTC_NOINIT_ATTR Notification::PersistRecord Notification::rtcSnapshot[NOTIFICATION_PERSIST_KEYS];
+#elif NOTIFICATION_PERSIST_KEYS > 0
+static const char* PERSIST_NAMESPACE = "notification";
+#endif
+
 Notification::Notification() {
-    mutex = xSemaphoreCreateMutex();
-    if (mutex == nullptr) {
-        ESP_LOGE(TAG, "Failed to create mutex");
+    for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+        for (uint32_t i = 0; i < NOTIFICATION_ISR_QUEUE_LEN; i++) {
+            shards[s].isrQueue[i].seq.store(i, std::memory_order_relaxed);
+        }
+        
+        for (size_t i = 0; i < NOTIFICATION_TTL_WHEEL_SIZE; i++) {
+            shards[s].wheel[i] = NotificationKey::INVALID;
+        }
+        
+#if NOTIFICATION_STATIC_ALLOCATION
+        shards[s].mutex = xSemaphoreCreateMutexStatic(&shards[s].mutexBuffer);
+#else
+        shards[s].mutex = xSemaphoreCreateMutex();
+#endif
+        if (shards[s].mutex == nullptr) {
+            ESP_LOGE(TAG, "Failed to create mutex for shard %zu", s);
+        }
+    }
+    
+#if NOTIFICATION_STATIC_ALLOCATION
+    reaper = xTimerCreateStatic("notify_ttl", TTL_RESOLUTION, pdTRUE, this, reapTimer, &reaperBuffer);
+#else
+    reaper = xTimerCreate("notify_ttl", TTL_RESOLUTION, pdTRUE, this, reapTimer);
+#endif
+    if (reaper == nullptr) {
+        ESP_LOGE(TAG, "Failed to create TTL reaper, expired items are only dropped lazily");
+    }
+#if NOTIFICATION_PERSIST_KEYS > 0
+    restorePersisted();
+#endif
+#if NOTIFICATION_TRACE_SYSVIEW
+    // One module serves every instance
+    static std::atomic<bool> traceRegistered{false};
+    if (!traceRegistered.exchange(true)) {
+        SEGGER_SYSVIEW_RegisterModule(&traceModule);
     }
+#endif
     ESP_LOGI(TAG, "Notification system initialized");
 }
 
+void* Notification::operator new(size_t size) noexcept {
+    return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+void Notification::operator delete(void* memory) {
+    heap_caps_free(memory);
+}
+
 Notification::~Notification() {
+    // Stop the reaper and dispatchers before the shard locks they take go away
+    if (reaper != nullptr) {
+        // xTimerDelete() only queues a command. The timer task runs commands and
+        // callbacks in order, so once the pended call below has run, no reap() is in
+        // flight and the timer (whose buffer may live in this instance) is gone
+        xTimerDelete(reaper, portMAX_DELAY);
+        if (xTimerPendFunctionCall(reaperDrained, this, 0, portMAX_DELAY) == pdPASS) {
+            while (!reaperStopped.load()) {
+                vTaskDelay(1);
+            }
+        }
+    }
+    uint16_t stop = NotificationKey::INVALID;
+    for (size_t d = 0; d < DISPATCHERS; d++) {
+        for (int i = 0; dispatchers[d].queue != nullptr && i < NOTIFICATION_DISPATCH_TASKS; i++) {
+            if (dispatchers[d].tasks[i] != nullptr) {
+                xQueueSend(dispatchers[d].queue, &stop, portMAX_DELAY);
+            }
+        }
+    }
+    while (dispatchRunning.load() > 0) {
+        vTaskDelay(1);
+    }
+    for (size_t d = 0; d < DISPATCHERS; d++) {
+#if NOTIFICATION_STATIC_ALLOCATION
+        // Static tasks park instead of deleting themselves, their TCB and stack live in this instance
+        for (int i = 0; i < NOTIFICATION_DISPATCH_TASKS; i++) {
+            if (dispatchers[d].tasks[i] != nullptr) {
+                while (eTaskGetState(dispatchers[d].tasks[i]) != eSuspended) {
+                    vTaskDelay(1);
+                }
+                vTaskDelete(dispatchers[d].tasks[i]);
+            }
+        }
+#endif
+        if (dispatchers[d].queue != nullptr) {
+            vQueueDelete(dispatchers[d].queue);
+        }
+    }
     clear();
-    if (mutex != nullptr) {
-        vSemaphoreDelete(mutex);
+#if !NOTIFICATION_STATIC_ALLOCATION
+    for (size_t i = 0; i < NOTIFICATION_MAX_KEYS; i++) {
+        if (slots[i].capacity > 0) {
+            heap_caps_free(slots[i].queue);
+        }
+    }
+#endif
+    for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+        if (shards[s].mutex != nullptr) {
+            vSemaphoreDelete(shards[s].mutex);
+        }
     }
     ESP_LOGI(TAG, "Notification system destroyed");
 }
 
 bool Notification::send(const char* key, void* data) {
-    if (mutex == nullptr || key == nullptr) {
+    return send(key, data, 0);
+}
+
+bool Notification::send(const char* key, int signal) {
+    return send(key, signal, 0);
+}
+
+bool Notification::send(NotificationKey key, void* data) {
+    return send(key, data, 0);
+}
+
+bool Notification::send(NotificationKey key, int signal) {
+    return send(key, signal, 0);
+}
+
+bool Notification::send(const char* key, void* data, TickType_t ttl_ticks, uint8_t priority) {
+    Slot* slot = lockSlot(key, true);
+    if (slot != nullptr && slot->signalSlot) {
+        ESP_LOGE(TAG, "Can't send data to signal key: %s", key);
+        unlock(slot);
+        slot = nullptr;
+    }
+    if (slot == nullptr) {
+        releasePayload(data);
         return false;
     }
     
-    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to take mutex for send");
+    NotificationItem item(data);
+    item.ttl = ttl_ticks;
+    item.priority = priority;
+    return sendHeld(slot, item);
+}
+
+bool Notification::send(const char* key, int signal, TickType_t ttl_ticks, uint8_t priority) {
+    Slot* slot = lockSlot(key, true);
+    if (slot == nullptr) {
         return false;
     }
     
-    // Remove existing notification with same key if it exists
-    auto it = notifications.find(key);
-    if (it != notifications.end()) {
-        notifications.erase(it);
+    NotificationItem item(signal);
+    item.ttl = ttl_ticks;
+    item.priority = priority;
+    return sendHeld(slot, item);
+}
+
+bool Notification::send(NotificationKey key, void* data, TickType_t ttl_ticks, uint8_t priority) {
+    NotificationItem item(data);
+    item.ttl = ttl_ticks;
+    item.priority = priority;
+    if (handOff(key, item)) {
+        return true;
     }
     
-    // Add new notification
-    notifications.emplace(key, NotificationItem(data));
-    
-    ESP_LOGD(TAG, "Notification sent - key: %s, data: %p", key, data);
+    Slot* slot = lockSlot(key);
+    if (slot != nullptr && slot->signalSlot) {
+        ESP_LOGE(TAG, "Can't send data to signal key: %s", slot->key);
+        unlock(slot);
+        slot = nullptr;
+    }
+    if (slot == nullptr) {
+        releasePayload(data);
+        return false;
+    }
     
-    xSemaphoreGive(mutex);
-    return true;
+    return sendHeld(slot, item);
 }
 
-bool Notification::send(const char* key, int signal) {
-    if (mutex == nullptr || key == nullptr) {
-        return false;
+bool Notification::send(NotificationKey key, int signal, TickType_t ttl_ticks, uint8_t priority) {
+    if (key.index < NOTIFICATION_MAX_KEYS && slots[key.index].signalSlot && ttl_ticks == 0) {
+        // Fast path, the shard lock is only needed if a task is parked on the key
+        Slot* slot = &slots[key.index];
+        if (!publishSignal(slot, signal)) {
+            return false;
+        }
+        // Published first, so a waiter that registers after this check still sees the value
+        if (slot->waiting.load() > 0) {
+            wakeSignalWaiters(slot);
+        }
+        return true;
     }
     
-    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to take mutex for send");
+    NotificationItem item(signal);
+    item.ttl = ttl_ticks;
+    item.priority = priority;
+    if (handOff(key, item)) {
+        return true;
+    }
+    
+    Slot* slot = lockSlot(key);
+    if (slot == nullptr) {
         return false;
     }
+    return sendHeld(slot, item);
+}
+
+void* Notification::consume(const char* key, TickType_t timeout_ticks) {
+    // Interned so a waiter has a slot to block on
+    Slot* slot = lockSlot(key, true);
+    NotificationItem item;
+    if (slot == nullptr || consumeHeld(slot, NotificationPayload::Data, timeout_ticks, item) != NotificationStatus::Ok) {
+        return nullptr;
+    }
+    return item.data;
+}
+
+void* Notification::consume(NotificationKey key, TickType_t timeout_ticks) {
+    Slot* slot = lockSlot(key);
+    NotificationItem item;
+    if (slot == nullptr || consumeHeld(slot, NotificationPayload::Data, timeout_ticks, item) != NotificationStatus::Ok) {
+        return nullptr;
+    }
+    return item.data;
+}
+
+int Notification::signal(const char* key, TickType_t timeout_ticks) {
+    Slot* slot = lockSlot(key, true);
+    NotificationItem item;
+    if (slot == nullptr || consumeHeld(slot, NotificationPayload::Signal, timeout_ticks, item) != NotificationStatus::Ok) {
+        return -1;
+    }
+    return item.signal;
+}
+
+int Notification::signal(NotificationKey key, TickType_t timeout_ticks) {
+    if (key.index < NOTIFICATION_MAX_KEYS && slots[key.index].signalSlot) {
+        int32_t value = takeSignal(&slots[key.index]);
+        if (value != SIGNAL_EMPTY) {
+            countStat(&slots[key.index], &NotificationStats::consumes);
+            trace(NotificationTraceType::Consume, key.index);
+            return value;
+        }
+        if (timeout_ticks == 0) {
+            return -1;
+        }
+        // Nothing yet, block on the waiter registry like any other key
+    }
     
-    // Remove existing notification with same key if it exists
-    auto it = notifications.find(key);
-    if (it != notifications.end()) {
-        notifications.erase(it);
+    Slot* slot = lockSlot(key);
+    NotificationItem item;
+    if (slot == nullptr || consumeHeld(slot, NotificationPayload::Signal, timeout_ticks, item) != NotificationStatus::Ok) {
+        return -1;
+    }
+    return item.signal;
+}
+
+NotificationStatus Notification::trySend(const char* key, void* data) {
+    NotificationStatus status;
+    Slot* slot = tryLockSlot(key, true, 0, status);
+    if (slot != nullptr && slot->signalSlot) {
+        ESP_LOGE(TAG, "Can't send data to signal key: %s", key);
+        unlock(slot);
+        slot = nullptr;
+    }
+    if (slot == nullptr) {
+        // Contended leaves the payload with the caller for a retry
+        if (status != NotificationStatus::Contended) {
+            releasePayload(data);
+            return NotificationStatus::Rejected;
+        }
+        return status;
     }
     
-    // Add new notification
-    notifications.emplace(key, NotificationItem(signal));
+    return sendHeld(slot, NotificationItem(data), false) ? NotificationStatus::Ok : NotificationStatus::Rejected;
+}
+
+NotificationStatus Notification::trySend(const char* key, int signal) {
+    NotificationStatus status;
+    Slot* slot = tryLockSlot(key, true, 0, status);
+    if (slot == nullptr) {
+        return status;
+    }
     
-    ESP_LOGD(TAG, "Notification sent - key: %s, signal: %d", key, signal);
+    return sendHeld(slot, NotificationItem(signal), false) ? NotificationStatus::Ok : NotificationStatus::Rejected;
+}
+
+NotificationStatus Notification::trySend(NotificationKey key, void* data) {
+    NotificationStatus status;
+    Slot* slot = tryLockSlot(key, 0, status);
+    if (slot != nullptr && slot->signalSlot) {
+        ESP_LOGE(TAG, "Can't send data to signal key: %s", slot->key);
+        unlock(slot);
+        slot = nullptr;
+    }
+    if (slot == nullptr) {
+        if (status != NotificationStatus::Contended) {
+            releasePayload(data);
+            return NotificationStatus::Rejected;
+        }
+        return status;
+    }
     
-    xSemaphoreGive(mutex);
-    return true;
+    return sendHeld(slot, NotificationItem(data), false) ? NotificationStatus::Ok : NotificationStatus::Rejected;
 }
 
-void* Notification::consume(const char* key, TickType_t timeout_ticks) {
-    if (mutex == nullptr || key == nullptr) {
-        return nullptr;
+NotificationStatus Notification::trySend(NotificationKey key, int signal) {
+    if (key.index < NOTIFICATION_MAX_KEYS && slots[key.index].signalSlot) {
+        // Same as send(): publish, then wake without the shard lock, so it is never contended
+        Slot* slot = &slots[key.index];
+        if (!publishSignal(slot, signal)) {
+            return NotificationStatus::Rejected;
+        }
+        if (slot->waiting.load() > 0) {
+            wakeSignalWaiters(slot);
+        }
+        return NotificationStatus::Ok;
     }
     
-    TickType_t start_time = xTaskGetTickCount();
+    NotificationStatus status;
+    Slot* slot = tryLockSlot(key, 0, status);
+    if (slot == nullptr) {
+        return status;
+    }
     
-    while (true) {
-        if (xSemaphoreTake(mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-            auto it = notifications.find(key);
-            if (it != notifications.end()) {
-                void* data = it->second.data;
-                notifications.erase(it);
-                
-                ESP_LOGD(TAG, "Notification consumed - key: %s, data: %p", key, data);
-                
-                xSemaphoreGive(mutex);
-                return data;
-            }
-            xSemaphoreGive(mutex);
-        }
-        
-        // Check timeout
-        TickType_t elapsed = xTaskGetTickCount() - start_time;
-        if (elapsed >= timeout_ticks) {
-            ESP_LOGD(TAG, "Timeout waiting for notification: %s", key);
-            break;
-        }
-        
-        // Small delay to prevent busy waiting
-        vTaskDelay(pdMS_TO_TICKS(1));
+    return sendHeld(slot, NotificationItem(signal), false) ? NotificationStatus::Ok : NotificationStatus::Rejected;
+}
+
+NotificationStatus Notification::tryConsume(const char* key, void*& data, TickType_t timeout_ticks) {
+    // Only interned when it will block, so a key that was never sent reads as Empty
+    NotificationStatus status;
+    Slot* slot = tryLockSlot(key, timeout_ticks > 0, 0, status);
+    if (slot == nullptr) {
+        return status;
     }
     
-    return nullptr;
+    NotificationItem item;
+    status = consumeHeld(slot, NotificationPayload::Data, timeout_ticks, item);
+    if (status == NotificationStatus::Ok) {
+        data = item.data;
+    }
+    return status;
 }
 
-int Notification::signal(const char* key, TickType_t timeout_ticks) {
-    if (mutex == nullptr || key == nullptr) {
-        return -1;
+NotificationStatus Notification::tryConsume(const char* key, int& signal, TickType_t timeout_ticks) {
+    NotificationStatus status;
+    Slot* slot = tryLockSlot(key, timeout_ticks > 0, 0, status);
+    if (slot == nullptr) {
+        return status;
     }
     
-    TickType_t start_time = xTaskGetTickCount();
+    NotificationItem item;
+    status = consumeHeld(slot, NotificationPayload::Signal, timeout_ticks, item);
+    if (status == NotificationStatus::Ok) {
+        signal = item.signal;
+    }
+    return status;
+}
+
+NotificationStatus Notification::tryConsume(NotificationKey key, void*& data, TickType_t timeout_ticks) {
+    NotificationStatus status;
+    Slot* slot = tryLockSlot(key, 0, status);
+    if (slot == nullptr) {
+        return status;
+    }
     
-    while (true) {
-        if (xSemaphoreTake(mutex, pdMS_TO_TICKS(0)) == pdTRUE) {
-            auto it = notifications.find(key);
-            if (it != notifications.end()) {
-                int signal = it->second.signal;
-                notifications.erase(it);
-                
-                ESP_LOGD(TAG, "Notification consumed - key: %s, signal: %p", key, signal);
-                
-                xSemaphoreGive(mutex);
-                return signal;
-            }
-            xSemaphoreGive(mutex);
-        }
-        
-        // Check timeout
-        TickType_t elapsed = xTaskGetTickCount() - start_time;
-        if (elapsed >= timeout_ticks) {
-            ESP_LOGD(TAG, "Timeout waiting for notification: %s", key);
-            break;
+    NotificationItem item;
+    status = consumeHeld(slot, NotificationPayload::Data, timeout_ticks, item);
+    if (status == NotificationStatus::Ok) {
+        data = item.data;
+    }
+    return status;
+}
+
+NotificationStatus Notification::tryConsume(NotificationKey key, int& signal, TickType_t timeout_ticks) {
+    if (key.index < NOTIFICATION_MAX_KEYS && slots[key.index].signalSlot) {
+        int32_t value = takeSignal(&slots[key.index]);
+        if (value != SIGNAL_EMPTY) {
+            countStat(&slots[key.index], &NotificationStats::consumes);
+            trace(NotificationTraceType::Consume, key.index);
+            signal = value;
+            return NotificationStatus::Ok;
+        }
+        if (timeout_ticks == 0) {
+            return NotificationStatus::Empty;
         }
-        
-        // Small delay to prevent busy waiting
-        vTaskDelay(pdMS_TO_TICKS(1));
     }
     
-    return -1;
+    NotificationStatus status;
+    Slot* slot = tryLockSlot(key, 0, status);
+    if (slot == nullptr) {
+        return status;
+    }
+    
+    NotificationItem item;
+    status = consumeHeld(slot, NotificationPayload::Signal, timeout_ticks, item);
+    if (status == NotificationStatus::Ok) {
+        signal = item.signal;
+    }
+    return status;
+}
+
+void Notification::setLockTimeout(TickType_t timeout_ticks) {
+    lockTimeout.store(timeout_ticks, std::memory_order_relaxed);
 }
 
 bool Notification::has(const char* key) {
-    if (mutex == nullptr || key == nullptr) {
+    Slot* slot = lockSlot(key, false);
+    if (slot == nullptr) {
         return false;
     }
     
-    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+    bool exists = hasData(slot);
+    
+    unlock(slot);
+    return exists;
+}
+
+bool Notification::has(NotificationKey key) {
+    if (key.index < NOTIFICATION_MAX_KEYS && slots[key.index].signalSlot) {
+        return slots[key.index].signalWord.load() != SIGNAL_EMPTY;
+    }
+    
+    Slot* slot = lockSlot(key);
+    if (slot == nullptr) {
         return false;
     }
     
-    bool exists = notifications.find(key) != notifications.end();
+    bool exists = hasData(slot);
     
-    xSemaphoreGive(mutex);
+    unlock(slot);
     return exists;
 }
 
 bool Notification::hasSignal(const char* key) {
-    if (mutex == nullptr || key == nullptr) {
+    Slot* slot = lockSlot(key, false);
+    if (slot == nullptr) {
         return false;
     }
     
-    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+    bool exists = slot->signalSlot ? hasData(slot)
+                                   : hasData(slot) && slot->queue[slot->head].type == NotificationPayload::Signal;
+    
+    unlock(slot);
+    return exists;
+}
+
+bool Notification::hasSignal(NotificationKey key) {
+    if (key.index < NOTIFICATION_MAX_KEYS && slots[key.index].signalSlot) {
+        return slots[key.index].signalWord.load() != SIGNAL_EMPTY;
+    }
+    
+    Slot* slot = lockSlot(key);
+    if (slot == nullptr) {
         return false;
     }
     
-    bool exists = notifications.find(key) != notifications.end();
+    bool exists = hasData(slot) && slot->queue[slot->head].type == NotificationPayload::Signal;
     
-    xSemaphoreGive(mutex);
+    unlock(slot);
     return exists;
 }
 
 bool Notification::remove(const char* key) {
-    if (mutex == nullptr || key == nullptr) {
+    Slot* slot = lockSlot(key, false);
+    if (slot == nullptr) {
         return false;
     }
     
-    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
-        return false;
-    }
-    
-    auto it = notifications.find(key);
     bool removed = false;
     
-    if (it != notifications.end()) {
+    if (slot->signalSlot) {
+        removed = takeSignal(slot) != SIGNAL_EMPTY;
+    } else if (slot->size > 0) {
         ESP_LOGD(TAG, "Removing notification: %s", key);
-        notifications.erase(it);
+        drop(slot);
         removed = true;
     }
     
-    xSemaphoreGive(mutex);
+    unlock(slot);
     return removed;
 }
 
 void Notification::clear() {
-    if (mutex == nullptr) {
-        return;
-    }
-    
-    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
-        ESP_LOGE(TAG, "Failed to take mutex for clear");
-        return;
+    // One shard at a time, so no task waits behind more than a single shard walk.
+    // Items sent to a shard that has already been cleared stay pending
+    size_t count = 0;
+    for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+        if (!lockShards(1u << s, "clear")) {
+            continue;
+        }
+        
+        count += shards[s].pendingCount;
+        for (size_t i = s * SHARD_KEYS; i < (s + 1) * SHARD_KEYS; i++) {
+            if (slots[i].signalSlot) {
+                count += takeSignal(&slots[i]) != SIGNAL_EMPTY ? 1 : 0;
+            } else if (slots[i].size > 0) {
+                drop(&slots[i]);
+            }
+        }
+        xSemaphoreGive(shards[s].mutex);
     }
     
-    size_t count = notifications.size();
-    notifications.clear();
-    
     ESP_LOGD(TAG, "Cleared %zu notifications", count);
-    xSemaphoreGive(mutex);
 }
 
 size_t Notification::count() {
-    if (mutex == nullptr) {
+    // All shard locks, so the sum is a single consistent snapshot
+    if (!lockShards(ALL_SHARDS, "count")) {
         return 0;
     }
     
-    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
-        return 0;
+    size_t count = signalPending.load();
+    for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+        count += shards[s].pendingCount;
     }
     
-    size_t count = notifications.size();
-    
-    xSemaphoreGive(mutex);
+    unlockShards(ALL_SHARDS);
     return count;
 }
 
 bool Notification::wait(const char* key, TickType_t timeout_ticks) {
-    if (key == nullptr) {
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && waitHeld(slot, timeout_ticks);
+}
+
+bool Notification::wait(NotificationKey key, TickType_t timeout_ticks) {
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && waitHeld(slot, timeout_ticks);
+}
+
+bool Notification::waitUntil(const char* key, NotificationCompare compare, int threshold,
+                             int* signal, TickType_t timeout_ticks) {
+    Waiter waiter = {};
+    waiter.conditional = true;
+    waiter.compare = compare;
+    waiter.threshold = threshold;
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && waitUntilHeld(slot, waiter, signal, timeout_ticks);
+}
+
+bool Notification::waitUntil(NotificationKey key, NotificationCompare compare, int threshold,
+                             int* signal, TickType_t timeout_ticks) {
+    Waiter waiter = {};
+    waiter.conditional = true;
+    waiter.compare = compare;
+    waiter.threshold = threshold;
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && waitUntilHeld(slot, waiter, signal, timeout_ticks);
+}
+
+bool Notification::waitUntil(const char* key, NotificationPredicate predicate, void* ctx,
+                             int* signal, TickType_t timeout_ticks) {
+    if (predicate == nullptr) {
+        return false;
+    }
+    Waiter waiter = {};
+    waiter.conditional = true;
+    waiter.predicate = predicate;
+    waiter.predicateCtx = ctx;
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && waitUntilHeld(slot, waiter, signal, timeout_ticks);
+}
+
+bool Notification::waitUntil(NotificationKey key, NotificationPredicate predicate, void* ctx,
+                             int* signal, TickType_t timeout_ticks) {
+    if (predicate == nullptr) {
         return false;
     }
+    Waiter waiter = {};
+    waiter.conditional = true;
+    waiter.predicate = predicate;
+    waiter.predicateCtx = ctx;
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && waitUntilHeld(slot, waiter, signal, timeout_ticks);
+}
+
+NotificationKey Notification::registerKey(const char* key) {
+    NotificationKey handle;
+    Slot* slot = lockSlot(key, true);
+    if (slot == nullptr) {
+        return handle;
+    }
     
-    TickType_t start_time = xTaskGetTickCount();
+    handle.index = (uint16_t)(slot - slots);
     
-    while (true) {
-        if (has(key)) {
+    ESP_LOGD(TAG, "Key registered - key: %s, handle: %u", key, handle.index);
+    
+    unlock(slot);
+    return handle;
+}
+
+bool Notification::installKeys(const NotificationKeyInfo* keys, size_t count) {
+    bool installed = true;
+    for (size_t i = 0; i < count; i++) {
+        size_t length = strlen(keys[i].name);
+        if (length >= NOTIFICATION_KEY_MAX_LEN) {
+            ESP_LOGE(TAG, "Key too long (max %d): %s", NOTIFICATION_KEY_MAX_LEN - 1, keys[i].name);
+            installed = false;
+            continue;
+        }
+        
+        Slot* slot = &slots[notificationHomeSlot(keys[i].hash)];
+        uint32_t mask = 1u << shardOf(slot);
+        if (!lockShards(mask, "installKeys")) {
+            installed = false;
+            continue;
+        }
+        
+        // Slots are never freed, so an empty one isn't inside any other key's probe run
+        if (slot->hash == 0) {
+            claimSlot(slot, keys[i].name, keys[i].hash, length);
+            ESP_LOGD(TAG, "Key installed - key: %s, handle: %u", keys[i].name, (unsigned)(slot - slots));
+        } else if (slot->hash != keys[i].hash || strcmp(slot->key, keys[i].name) != 0) {
+            ESP_LOGE(TAG, "Home slot of %s already taken by %s, install keys before sending", keys[i].name, slot->key);
+            installed = false;
+        }
+        unlockShards(mask);
+    }
+    return installed;
+}
+
+bool Notification::setQueueMode(const char* key, size_t depth, NotificationOverflow overflow, TickType_t block_ticks) {
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && setQueueModeHeld(slot, depth, overflow, block_ticks, false);
+}
+
+bool Notification::setQueueMode(NotificationKey key, size_t depth, NotificationOverflow overflow, TickType_t block_ticks) {
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && setQueueModeHeld(slot, depth, overflow, block_ticks, false);
+}
+
+bool Notification::setPriority(const char* key, uint8_t priority) {
+    Slot* slot = lockSlot(key, true);
+    if (slot == nullptr) {
+        return false;
+    }
+    
+    slot->priority = priority;
+    ESP_LOGD(TAG, "Priority set - key: %s, priority: %u", key, priority);
+    
+    unlock(slot);
+    return true;
+}
+
+bool Notification::setPriority(NotificationKey key, uint8_t priority) {
+    Slot* slot = lockSlot(key);
+    if (slot == nullptr) {
+        return false;
+    }
+    
+    slot->priority = priority;
+    ESP_LOGD(TAG, "Priority set - key: %s, priority: %u", slot->key, priority);
+    
+    unlock(slot);
+    return true;
+}
+
+bool Notification::setCoalescing(const char* key, bool enabled, TickType_t min_interval) {
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && setCoalescingHeld(slot, enabled, min_interval);
+}
+
+bool Notification::setCoalescing(NotificationKey key, bool enabled, TickType_t min_interval) {
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && setCoalescingHeld(slot, enabled, min_interval);
+}
+
+bool Notification::setCoalescingHeld(Slot* slot, bool enabled, TickType_t min_interval) {
+    if (slot->signalSlot || slot->broadcast) {
+        ESP_LOGE(TAG, "Can't coalesce %s key: %s", slot->signalSlot ? "signal" : "broadcast", slot->key);
+        unlock(slot);
+        return false;
+    }
+    
+    slot->coalesce = enabled;
+    slot->coalesceTicks = min_interval;
+    if (!enabled && slot->wakePending) {
+        slot->wakePending = false;
+        wakeWaiters(slot, false);
+    }
+    
+    ESP_LOGD(TAG, "Coalescing %s - key: %s, interval: %lu", enabled ? "on" : "off",
+             slot->key, (unsigned long)min_interval);
+    
+    unlock(slot);
+    return true;
+}
+
+bool Notification::setPersistent(const char* key, bool enabled) {
+#if NOTIFICATION_PERSIST_KEYS > 0
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && setPersistentHeld(slot, enabled);
+#else
+    (void)key;
+    (void)enabled;
+    ESP_LOGE(TAG, "Persistence compiled out, set NOTIFICATION_PERSIST_KEYS");
+    return false;
+#endif
+}
+
+bool Notification::setPersistent(NotificationKey key, bool enabled) {
+#if NOTIFICATION_PERSIST_KEYS > 0
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && setPersistentHeld(slot, enabled);
+#else
+    (void)key;
+    (void)enabled;
+    ESP_LOGE(TAG, "Persistence compiled out, set NOTIFICATION_PERSIST_KEYS");
+    return false;
+#endif
+}
+
+size_t Notification::persist() {
+#if NOTIFICATION_PERSIST_KEYS > 0 && NOTIFICATION_PERSIST_STORE == NOTIFICATION_PERSIST_NVS
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(PERSIST_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS for persistence: %s", esp_err_to_name(err));
+        return 0;
+    }
+    
+    size_t written = 0;
+    for (size_t i = 0; i < NOTIFICATION_MAX_KEYS; i++) {
+        // A stale peek is checked again under the lock, or waits for the next call
+        if (slots[i].persist == 0) {
+            continue;
+        }
+        
+        NotificationKey key;
+        key.index = (uint16_t)i;
+        Slot* slot = lockSlot(key);
+        if (slot == nullptr) {
+            continue;
+        }
+        if (slot->persist == 0) {
+            unlock(slot);
+            continue;
+        }
+        
+        // Copy under the lock, write the flash outside it
+        Persisted& entry = persistTable[slot->persist - 1];
+        bool dirty = entry.dirty;
+        PersistRecord record = entry.record;
+        entry.dirty = false;
+        unlock(slot);
+        
+        if (!dirty) {
+            continue;
+        }
+        
+        // One blob per key, named by key hash so it is the same on every boot
+        char name[12];
+        snprintf(name, sizeof(name), "k%08lx", (unsigned long)slots[i].hash);
+        
+        if (record.type == NotificationPayload::None) {
+            err = nvs_erase_key(nvs, name);
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                err = ESP_OK;
+            }
+        } else {
+            // Packed: type, size, payload, key with its NUL
+            uint8_t blob[3 + sizeof(record.value) + NOTIFICATION_KEY_MAX_LEN];
+            size_t length = strlen(record.key) + 1;
+            blob[0] = (uint8_t)record.type;
+            blob[1] = record.size;
+            memcpy(blob + 2, record.value, record.size);
+            memcpy(blob + 2 + record.size, record.key, length);
+            err = nvs_set_blob(nvs, name, blob, 2 + record.size + length);
+        }
+        
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to persist key: %s, %s", record.key, esp_err_to_name(err));
+            if ((slot = lockSlot(key)) != nullptr) {
+                if (slot->persist != 0) {
+                    persistTable[slot->persist - 1].dirty = true;
+                }
+                unlock(slot);
+            }
+            continue;
+        }
+        written++;
+        
+        // The erase is written, so a key that is still off can give its record back
+        if (record.type == NotificationPayload::None && (slot = lockSlot(key)) != nullptr) {
+            if (slot->persist != 0 && !persistTable[slot->persist - 1].enabled &&
+                !persistTable[slot->persist - 1].dirty) {
+                releasePersistHeld(slot);
+            }
+            unlock(slot);
+        }
+    }
+    
+    if (written > 0 && (err = nvs_commit(nvs)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to commit persistent keys: %s", esp_err_to_name(err));
+    }
+    nvs_close(nvs);
+    
+    ESP_LOGD(TAG, "Persisted %zu keys", written);
+    return written;
+#else
+    return 0;
+#endif
+}
+
+#if NOTIFICATION_PERSIST_KEYS > 0
+bool Notification::setPersistentHeld(Slot* slot, bool enabled) {
+    if (slot->signalSlot || slot->broadcast || slot->depth > 1) {
+        ESP_LOGE(TAG, "Only latest-value keys can be persistent: %s", slot->key);
+        unlock(slot);
+        return false;
+    }
+    
+    if (slot->persist == 0) {
+        if (!enabled) {
+            unlock(slot);
             return true;
         }
         
-        // Check timeout
-        TickType_t elapsed = xTaskGetTickCount() - start_time;
-        if (elapsed >= timeout_ticks) {
-            ESP_LOGD(TAG, "Timeout waiting for notification: %s", key);
+        // Keys in different shards can race here, so claim a free record with a CAS
+        size_t index = 0;
+        for (; index < NOTIFICATION_PERSIST_KEYS; index++) {
+            bool used = false;
+            if (persistTable[index].used.compare_exchange_strong(used, true)) {
+                break;
+            }
+        }
+        if (index == NOTIFICATION_PERSIST_KEYS) {
+            ESP_LOGE(TAG, "Too many persistent keys, can't add: %s", slot->key);
+            unlock(slot);
             return false;
         }
         
-        // Small delay to prevent busy waiting
-        vTaskDelay(pdMS_TO_TICKS(10));
+        Persisted& entry = persistTable[index];
+        memset(&entry.record, 0, sizeof(entry.record));
+        memcpy(entry.record.key, slot->key, strlen(slot->key) + 1);
+        entry.dirty = false;
+        slot->persist = (uint8_t)(index + 1);
+    }
+    
+    Persisted& entry = persistTable[slot->persist - 1];
+    entry.enabled = enabled;
+    if (enabled && slot->size > 0) {
+        // Record what is already pending, the key may have been flagged late
+        persistHeld(slot, slot->queue[slot->head]);
+    } else if (!enabled) {
+        entry.record.type = NotificationPayload::None;
+        entry.record.size = 0;
+        entry.record.check = 0;
+        entry.dirty = true;
+#if NOTIFICATION_PERSIST_STORE == NOTIFICATION_PERSIST_RTC
+        rtcSnapshot[slot->persist - 1].check = 0;
+        // Nothing left to write, NVS keeps the record until persist() has erased the blob
+        releasePersistHeld(slot);
+#endif
+    }
+    
+    ESP_LOGD(TAG, "Persistence %s - key: %s", enabled ? "on" : "off", slot->key);
+    
+    unlock(slot);
+    return true;
+}
+
+void Notification::persistHeld(Slot* slot, const NotificationItem& item) {
+    Persisted& entry = persistTable[slot->persist - 1];
+    if (!entry.enabled) {
+        return;
+    }
+    
+    // A pointer means nothing after a reset, only ints and inline values are kept
+    PersistRecord& record = entry.record;
+    if (item.type == NotificationPayload::Signal) {
+        record.size = sizeof(int);
+        memcpy(record.value, &item.signal, sizeof(int));
+    } else if (item.type == NotificationPayload::Value) {
+        record.size = item.valueSize;
+        memcpy(record.value, item.value, item.valueSize);
+    } else {
+        return;
+    }
+    record.type = item.type;
+    record.check = checksum(record);
+    entry.dirty = true;
+    
+#if NOTIFICATION_PERSIST_STORE == NOTIFICATION_PERSIST_RTC
+    rtcSnapshot[slot->persist - 1] = record;
+#endif
+}
+
+void Notification::releasePersistHeld(Slot* slot) {
+    Persisted& entry = persistTable[slot->persist - 1];
+    entry.enabled = false;
+    entry.dirty = false;
+    slot->persist = 0;
+    entry.used.store(false);
+}
+
+void Notification::restoreRecord(const PersistRecord& record) {
+    if (record.type != NotificationPayload::Signal && record.type != NotificationPayload::Value) {
+        return;
+    }
+    if (memchr(record.key, '\0', sizeof(record.key)) == nullptr || record.size > sizeof(record.value) ||
+        (record.type == NotificationPayload::Signal && record.size != sizeof(int)) ||
+        (record.type == NotificationPayload::Value && record.size > NOTIFICATION_INLINE_PAYLOAD_SIZE)) {
+        ESP_LOGW(TAG, "Skipping malformed persistent record");
+        return;
+    }
+    
+    Slot* slot = lockSlot(record.key, true);
+    if (slot == nullptr) {
+        return;
+    }
+    // Takes the lock's ownership, so take it again to send the value
+    if (!setPersistentHeld(slot, true) || (slot = lockSlot(record.key, false)) == nullptr) {
+        return;
+    }
+    
+    int signal;
+    memcpy(&signal, record.value, sizeof(int));
+    NotificationItem item = record.type == NotificationPayload::Signal
+                                ? NotificationItem(signal)
+                                : NotificationItem(record.value, record.size);
+    storeHeld(slot, item, false);
+    
+    // Nothing changed, no need to write it back
+    persistTable[slot->persist - 1].dirty = false;
+    
+    ESP_LOGD(TAG, "Restored key: %s", slot->key);
+    
+    unlock(slot);
+}
+
+void Notification::restorePersisted() {
+#if NOTIFICATION_PERSIST_STORE == NOTIFICATION_PERSIST_RTC
+    // The image is rebuilt in restore order, so take a copy first
+    static PersistRecord previous[NOTIFICATION_PERSIST_KEYS];
+    memcpy(previous, rtcSnapshot, sizeof(previous));
+    memset(rtcSnapshot, 0, sizeof(rtcSnapshot));
+    
+    for (size_t i = 0; i < NOTIFICATION_PERSIST_KEYS; i++) {
+        if (previous[i].check != 0 && previous[i].check == checksum(previous[i])) {
+            restoreRecord(previous[i]);
+        }
+    }
+#else
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(PERSIST_NAMESPACE, NVS_READONLY, &nvs);
+    if (err != ESP_OK) {
+        // First boot, or NVS isn't initialized yet
+        ESP_LOGD(TAG, "No persistent keys restored: %s", esp_err_to_name(err));
+        return;
+    }
+    
+    nvs_iterator_t it = nullptr;
+    err = nvs_entry_find(NVS_DEFAULT_PART_NAME, PERSIST_NAMESPACE, NVS_TYPE_BLOB, &it);
+    while (err == ESP_OK) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+        
+        uint8_t blob[3 + sizeof(PersistRecord::value) + NOTIFICATION_KEY_MAX_LEN];
+        size_t length = sizeof(blob);
+        if (nvs_get_blob(nvs, info.key, blob, &length) == ESP_OK && length >= 3 &&
+            blob[1] <= sizeof(PersistRecord::value) && (size_t)2 + blob[1] < length &&
+            length - 2 - blob[1] <= NOTIFICATION_KEY_MAX_LEN) {
+            PersistRecord record = {};
+            record.type = (NotificationPayload)blob[0];
+            record.size = blob[1];
+            memcpy(record.value, blob + 2, record.size);
+            memcpy(record.key, blob + 2 + record.size, length - 2 - record.size);
+            restoreRecord(record);
+        }
+        
+        err = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+    nvs_close(nvs);
+#endif
+}
+
+uint32_t Notification::checksum(const PersistRecord& record) {
+    // FNV-1a over everything after the checksum, never 0 so 0 can mark an empty record
+    const uint8_t* bytes = (const uint8_t*)record.key;
+    const uint8_t* end = record.value + sizeof(record.value);
+    uint32_t hash = 2166136261u;
+    while (bytes < end) {
+        hash ^= *bytes++;
+        hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+#endif
+
+bool Notification::subscribe(const char* key, NotificationHandler handler, void* ctx, NotificationDispatch mode) {
+    if (handler == nullptr || !startDispatchers()) {
+        return false;
+    }
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && subscribeHeld(slot, handler, ctx, mode);
+}
+
+bool Notification::subscribe(NotificationKey key, NotificationHandler handler, void* ctx, NotificationDispatch mode) {
+    if (handler == nullptr || !startDispatchers()) {
+        return false;
+    }
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && subscribeHeld(slot, handler, ctx, mode);
+}
+
+bool Notification::subscribeHeld(Slot* slot, NotificationHandler handler, void* ctx, NotificationDispatch mode) {
+    if (slot->signalSlot || slot->broadcast) {
+        ESP_LOGE(TAG, "Can't subscribe to %s key: %s",
+                 slot->signalSlot ? "signal" : "broadcast", slot->key);
+        unlock(slot);
+        return false;
+    }
+    
+    slot->handler = handler;
+    slot->handlerCtx = ctx;
+    slot->dispatch = mode;
+    
+    // Anything sent before the subscription goes to the pool
+    if (slot->size > 0) {
+        queueDispatch(slot);
+    }
+    
+    ESP_LOGD(TAG, "Subscribed - key: %s, %s", slot->key,
+             mode == NotificationDispatch::Inline ? "inline" : "deferred");
+    
+    unlock(slot);
+    return true;
+}
+
+bool Notification::unsubscribe(const char* key) {
+    Slot* slot = lockSlot(key, false);
+    if (slot == nullptr) {
+        return false;
+    }
+    
+    bool subscribed = slot->handler != nullptr;
+    slot->handler = nullptr;
+    slot->handlerCtx = nullptr;
+    
+    unlock(slot);
+    return subscribed;
+}
+
+bool Notification::unsubscribe(NotificationKey key) {
+    Slot* slot = lockSlot(key);
+    if (slot == nullptr) {
+        return false;
+    }
+    
+    bool subscribed = slot->handler != nullptr;
+    slot->handler = nullptr;
+    slot->handlerCtx = nullptr;
+    
+    unlock(slot);
+    return subscribed;
+}
+
+void Notification::waitHandlerIdle(NotificationKey key) {
+    if (key.index >= NOTIFICATION_MAX_KEYS) {
+        return;
+    }
+    // Counted under the shard lock before it is released, so a call unsubscribe() missed shows up here
+    while (slots[key.index].delivering.load() > 0) {
+        vTaskDelay(1);
+    }
+}
+
+bool Notification::setAffinity(const char* key, BaseType_t core) {
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && setAffinityHeld(slot, core);
+}
+
+bool Notification::setAffinity(NotificationKey key, BaseType_t core) {
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && setAffinityHeld(slot, core);
+}
+
+bool Notification::setAffinityHeld(Slot* slot, BaseType_t core) {
+    if (core != tskNO_AFFINITY && (core < 0 || core >= portNUM_PROCESSORS)) {
+        ESP_LOGE(TAG, "Invalid core %d for key: %s", (int)core, slot->key);
+        unlock(slot);
+        return false;
+    }
+    
+    // Takes effect from the key's next dispatch, one already queued runs where it is
+    slot->affinity = core == tskNO_AFFINITY ? 0 : (uint8_t)(core + 1);
+    ESP_LOGD(TAG, "Affinity set - key: %s, core: %d", slot->key, (int)core);
+    
+    unlock(slot);
+    return true;
+}
+
+NotificationPattern Notification::registerPattern(const char* pattern) {
+    NotificationPattern handle;
+    size_t segments;
+    if (pattern == nullptr || strlen(pattern) >= NOTIFICATION_KEY_MAX_LEN ||
+        !validPattern(pattern, &segments)) {
+        ESP_LOGE(TAG, "Invalid pattern: %s", pattern != nullptr ? pattern : "(null)");
+        return handle;
+    }
+    
+    // Every shard lock, the index is read under any one of them
+    if (!lockShards(ALL_SHARDS, "registerPattern")) {
+        return handle;
+    }
+    
+    int unused = -1;
+    for (int i = 0; i < NOTIFICATION_MAX_PATTERNS; i++) {
+        if (strcmp(patternTable[i].text, pattern) == 0) {
+            handle.index = (uint8_t)i;
+            unlockShards(ALL_SHARDS);
+            return handle;
+        }
+        if (unused < 0 && patternTable[i].text[0] == '\0') {
+            unused = i;
+        }
+    }
+    
+    // Worst case every segment needs a new node
+    if (unused < 0 || patternNodeCount + segments > NOTIFICATION_MAX_PATTERN_NODES) {
+        ESP_LOGE(TAG, "Pattern table full (%d patterns, %d nodes), dropping: %s",
+                 NOTIFICATION_MAX_PATTERNS, NOTIFICATION_MAX_PATTERN_NODES, pattern);
+        unlockShards(ALL_SHARDS);
+        return handle;
+    }
+    
+    uint32_t bit = 1u << unused;
+    strcpy(patternTable[unused].text, pattern);
+    insertPattern(pattern, bit);
+    
+    // Keys that already exist are matched once here, new ones when they are interned
+    for (size_t i = 0; i < NOTIFICATION_MAX_KEYS; i++) {
+        if (slots[i].hash != 0 && patternMatches(pattern, slots[i].key)) {
+            slots[i].patterns |= bit;
+        }
+    }
+    
+    handle.index = (uint8_t)unused;
+    ESP_LOGD(TAG, "Pattern registered - pattern: %s, handle: %u", pattern, handle.index);
+    
+    unlockShards(ALL_SHARDS);
+    return handle;
+}
+
+bool Notification::subscribe(NotificationPattern pattern, NotificationHandler handler, void* ctx, NotificationDispatch mode) {
+    if (!pattern.valid() || pattern.index >= NOTIFICATION_MAX_PATTERNS || handler == nullptr ||
+        !startDispatchers()) {
+        return false;
+    }
+    
+    if (!lockShards(ALL_SHARDS, "subscribe")) {
+        return false;
+    }
+    
+    Pattern& record = patternTable[pattern.index];
+    if (record.text[0] == '\0') {
+        unlockShards(ALL_SHARDS);
+        return false;
+    }
+    record.handler = handler;
+    record.handlerCtx = ctx;
+    record.dispatch = mode;
+    
+    for (size_t i = 0; i < NOTIFICATION_MAX_KEYS; i++) {
+        if (slots[i].hash != 0 && (slots[i].patterns & (1u << pattern.index))) {
+            bindPattern(&slots[i]);
+        }
+    }
+    
+    ESP_LOGD(TAG, "Subscribed - pattern: %s", record.text);
+    
+    unlockShards(ALL_SHARDS);
+    return true;
+}
+
+void* Notification::consumePattern(NotificationPattern pattern, NotificationKey* matched, TickType_t timeout_ticks) {
+    if (!pattern.valid() || pattern.index >= NOTIFICATION_MAX_PATTERNS ||
+        !lockShards(ALL_SHARDS, "consumePattern")) {
+        return nullptr;
+    }
+    
+    Waiter waiter = {};
+    waiter.pattern = 1u << pattern.index;
+    waiter.payload = NotificationPayload::Data;
+    int index = block(waiter, timeout_ticks);
+    
+    void* data = nullptr;
+    if (index >= 0) {
+        NotificationItem item = takeHeld(&slots[index]);
+        data = item.asData();
+        if (matched != nullptr) {
+            matched->index = (uint16_t)index;
+        }
+        ESP_LOGD(TAG, "Notification consumed - key: %s, pattern: %s",
+                 slots[index].key, patternTable[pattern.index].text);
+    }
+    
+    unlockShards(ALL_SHARDS);
+    return data;
+}
+
+void* Notification::consumePattern(const char* pattern, NotificationKey* matched, TickType_t timeout_ticks) {
+    return consumePattern(registerPattern(pattern), matched, timeout_ticks);
+}
+
+bool Notification::waitPattern(NotificationPattern pattern, NotificationKey* matched, TickType_t timeout_ticks) {
+    if (!pattern.valid() || pattern.index >= NOTIFICATION_MAX_PATTERNS ||
+        !lockShards(ALL_SHARDS, "waitPattern")) {
+        return false;
+    }
+    
+    Waiter waiter = {};
+    waiter.pattern = 1u << pattern.index;
+    int index = block(waiter, timeout_ticks);
+    if (index >= 0 && matched != nullptr) {
+        matched->index = (uint16_t)index;
+    }
+    
+    unlockShards(ALL_SHARDS);
+    return index >= 0;
+}
+
+bool Notification::waitPattern(const char* pattern, NotificationKey* matched, TickType_t timeout_ticks) {
+    return waitPattern(registerPattern(pattern), matched, timeout_ticks);
+}
+
+uint32_t Notification::hashSegment(const char* segment, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)segment[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool Notification::validPattern(const char* pattern, size_t* segments) {
+    // Wildcards must fill their segment, and '#' must be the last one
+    *segments = 0;
+    const char* segment = pattern;
+    while (true) {
+        const char* end = strchr(segment, '/');
+        size_t length = end != nullptr ? (size_t)(end - segment) : strlen(segment);
+        if ((memchr(segment, '+', length) != nullptr || memchr(segment, '#', length) != nullptr) &&
+            length != 1) {
+            return false;
+        }
+        if (segment[0] == '#' && end != nullptr) {
+            return false;
+        }
+        (*segments)++;
+        if (end == nullptr) {
+            return true;
+        }
+        segment = end + 1;
+    }
+}
+
+bool Notification::patternMatches(const char* pattern, const char* key) {
+    while (true) {
+        if (pattern[0] == '#') {
+            return true;
+        }
+        
+        const char* patternEnd = strchr(pattern, '/');
+        const char* keyEnd = strchr(key, '/');
+        size_t patternLength = patternEnd != nullptr ? (size_t)(patternEnd - pattern) : strlen(pattern);
+        size_t keyLength = keyEnd != nullptr ? (size_t)(keyEnd - key) : strlen(key);
+        
+        bool wildcard = patternLength == 1 && pattern[0] == '+';
+        if (!wildcard && (patternLength != keyLength || memcmp(pattern, key, keyLength) != 0)) {
+            return false;
+        }
+        
+        if (patternEnd == nullptr || keyEnd == nullptr) {
+            // "a/#" also matches "a" itself
+            return patternEnd == nullptr ? keyEnd == nullptr : strcmp(patternEnd, "/#") == 0;
+        }
+        pattern = patternEnd + 1;
+        key = keyEnd + 1;
+    }
+}
+
+void Notification::insertPattern(const char* pattern, uint32_t bit) {
+    uint8_t node = 0;
+    const char* segment = pattern;
+    
+    while (true) {
+        const char* end = strchr(segment, '/');
+        size_t length = end != nullptr ? (size_t)(end - segment) : strlen(segment);
+        uint8_t kind = SEGMENT_EXACT;
+        if (length == 1 && segment[0] == '+') {
+            kind = SEGMENT_ONE;
+        } else if (length == 1 && segment[0] == '#') {
+            kind = SEGMENT_REST;
+        }
+        uint32_t hash = kind == SEGMENT_EXACT ? hashSegment(segment, length) : 0;
+        
+        uint8_t child = patternNodes[node].child;
+        while (child != 0 && (patternNodes[child].kind != kind || patternNodes[child].hash != hash)) {
+            child = patternNodes[child].sibling;
+        }
+        if (child == 0) {
+            child = patternNodeCount++;
+            patternNodes[child] = PatternNode();
+            patternNodes[child].hash = hash;
+            patternNodes[child].kind = kind;
+            patternNodes[child].sibling = patternNodes[node].child;
+            patternNodes[node].child = child;
+        }
+        node = child;
+        
+        if (end == nullptr) {
+            break;
+        }
+        segment = end + 1;
+    }
+    
+    patternNodes[node].patterns |= bit;
+}
+
+uint32_t Notification::matchTrie(uint8_t node, const char* segment) {
+    // segment is nullptr once every segment of the key has been matched
+    uint32_t bits = segment == nullptr ? patternNodes[node].patterns : 0;
+    
+    const char* next = nullptr;
+    uint32_t hash = 0;
+    if (segment != nullptr) {
+        const char* end = strchr(segment, '/');
+        size_t length = end != nullptr ? (size_t)(end - segment) : strlen(segment);
+        next = end != nullptr ? end + 1 : nullptr;
+        hash = hashSegment(segment, length);
+    }
+    
+    for (uint8_t child = patternNodes[node].child; child != 0; child = patternNodes[child].sibling) {
+        const PatternNode& candidate = patternNodes[child];
+        if (candidate.kind == SEGMENT_REST) {
+            bits |= candidate.patterns;
+        } else if (segment != nullptr && (candidate.kind == SEGMENT_ONE || candidate.hash == hash)) {
+            bits |= matchTrie(child, next);
+        }
+    }
+    return bits;
+}
+
+uint32_t Notification::matchPatterns(const char* key) {
+    if (patternNodes[0].child == 0) {
+        return 0;
+    }
+    
+    // The trie only compares segment hashes, confirm each candidate against its text
+    uint32_t bits = matchTrie(0, key);
+    for (int i = 0; i < NOTIFICATION_MAX_PATTERNS; i++) {
+        if ((bits & (1u << i)) && !patternMatches(patternTable[i].text, key)) {
+            bits &= ~(1u << i);
+        }
+    }
+    return bits;
+}
+
+void Notification::bindPattern(Slot* slot) {
+    if (slot->handler != nullptr || slot->signalSlot || slot->broadcast || slot->patterns == 0) {
+        return;
+    }
+    
+    // Lowest numbered subscribed pattern wins
+    for (int i = 0; i < NOTIFICATION_MAX_PATTERNS; i++) {
+        if ((slot->patterns & (1u << i)) && patternTable[i].handler != nullptr) {
+            slot->handler = patternTable[i].handler;
+            slot->handlerCtx = patternTable[i].handlerCtx;
+            slot->dispatch = patternTable[i].dispatch;
+            if (slot->size > 0) {
+                queueDispatch(slot);
+            }
+            return;
+        }
+    }
+}
+
+bool Notification::startDispatchers() {
+    // Serialized by the first shard lock, the pool is only ever started once
+    if (!lockShards(1, "subscribe")) {
+        return false;
+    }
+    
+    for (size_t d = 0; d < DISPATCHERS && dispatchers[d].queue == nullptr; d++) {
+        Dispatcher& dispatcher = dispatchers[d];
+        dispatcher.owner = this;
+#if NOTIFICATION_STATIC_ALLOCATION
+        dispatcher.queue = xQueueCreateStatic(NOTIFICATION_DISPATCH_QUEUE_LEN, sizeof(uint16_t),
+                                              dispatcher.queueStorage, &dispatcher.queueBuffer);
+#else
+        dispatcher.queue = xQueueCreate(NOTIFICATION_DISPATCH_QUEUE_LEN, sizeof(uint16_t));
+#endif
+        if (dispatcher.queue == nullptr) {
+            ESP_LOGE(TAG, "Failed to create dispatch queue %zu", d);
+            unlockShards(1);
+            return false;
+        }
+        
+        // Per-core queues get tasks pinned to their core, a shared queue floats
+        BaseType_t core = DISPATCHERS > 1 ? (BaseType_t)d : tskNO_AFFINITY;
+        for (int i = 0; i < NOTIFICATION_DISPATCH_TASKS; i++) {
+            dispatchRunning.fetch_add(1);
+#if NOTIFICATION_STATIC_ALLOCATION
+            dispatcher.tasks[i] = xTaskCreateStaticPinnedToCore(dispatchTask, "notify_dispatch",
+                                                                NOTIFICATION_DISPATCH_STACK, &dispatcher,
+                                                                NOTIFICATION_DISPATCH_PRIORITY, dispatcher.stacks[i],
+                                                                &dispatcher.taskBuffers[i], core);
+            if (dispatcher.tasks[i] == nullptr) {
+#else
+            if (xTaskCreatePinnedToCore(dispatchTask, "notify_dispatch", NOTIFICATION_DISPATCH_STACK, &dispatcher,
+                                        NOTIFICATION_DISPATCH_PRIORITY, &dispatcher.tasks[i], core) != pdPASS) {
+                dispatcher.tasks[i] = nullptr;
+#endif
+                ESP_LOGE(TAG, "Failed to create dispatcher task %d on queue %zu", i, d);
+                dispatchRunning.fetch_sub(1);
+            }
+        }
+    }
+    
+    bool running = dispatchRunning.load() > 0;
+    unlockShards(1);
+    return running;
+}
+
+QueueHandle_t IRAM_ATTR Notification::dispatchQueue(const Slot* slot) {
+#if NOTIFICATION_DISPATCH_PER_CORE
+    // Stay on the sender's core unless the key asked for one, so pinned pipelines don't cross
+    return dispatchers[slot->affinity > 0 ? slot->affinity - 1 : xPortGetCoreID()].queue;
+#else
+    (void)slot;
+    return dispatchers[0].queue;
+#endif
+}
+
+void Notification::queueDispatch(Slot* slot) {
+    QueueHandle_t queue = dispatchQueue(slot);
+    if (slot->dispatchQueued || queue == nullptr) {
+        return;
+    }
+    
+    uint16_t index = (uint16_t)(slot - slots);
+    if (xQueueSend(queue, &index, 0) == pdTRUE) {
+        slot->dispatchQueued = true;
+    } else {
+        // Stays pending, the key's next send tries again
+        ESP_LOGW(TAG, "Dispatch queue full - key: %s", slot->key);
+    }
+}
+
+Notification::NotificationItem Notification::takeHeld(Slot* slot) {
+    NotificationItem item = pop(slot);
+    countLatency(slot, item);
+    trace(NotificationTraceType::Consume, slot);
+    if (slot->overflow == NotificationOverflow::Block) {
+        wakeWaiters(slot, true);
+    }
+    return item;
+}
+
+void Notification::dispatchOne(uint16_t index) {
+    if ((index & DISPATCH_DRAIN) != 0) {
+        // Posted by sendFromISR(), storing the ring's items queues their slots as usual
+        size_t s = index & (DISPATCH_DRAIN - 1);
+        xSemaphoreTake(shards[s].mutex, portMAX_DELAY);
+        trace(NotificationTraceType::Lock, (uint16_t)s);
+        // Cleared first, so an ISR push racing the drain below posts another turn
+        shards[s].drainQueued.exchange(0);
+        drainIsrQueue(s);
+        xSemaphoreGive(shards[s].mutex);
+        return;
+    }
+    
+    Slot* slot = &slots[index];
+    Shard& shard = shards[shardOf(slot)];
+    
+    // Blocks rather than times out, a dropped turn would leave dispatchQueued set
+    xSemaphoreTake(shard.mutex, portMAX_DELAY);
+    trace(NotificationTraceType::Lock, (uint16_t)shardOf(slot));
+    drainIsrQueue(shardOf(slot));
+    
+    if (slot->handler == nullptr || !hasData(slot)) {
+        slot->dispatchQueued = false;
+        xSemaphoreGive(shard.mutex);
+        return;
+    }
+    
+    NotificationItem item = takeHeld(slot);
+    NotificationHandler handler = slot->handler;
+    void* ctx = slot->handlerCtx;
+    slot->delivering.fetch_add(1);
+    
+    // One item per turn, a busy key goes to the back so it can't starve the rest
+    slot->dispatchQueued = false;
+    if (slot->size > 0) {
+        queueDispatch(slot);
+    }
+    
+    xSemaphoreGive(shard.mutex);
+    
+    deliver(handler, ctx, index, item);
+    slot->delivering.fetch_sub(1);
+}
+
+void Notification::deliver(NotificationHandler handler, void* ctx, uint16_t index, const NotificationItem& item) {
+    NotificationEvent event;
+    event.key.index = index;
+    event.type = item.type;
+    event.data = item.asData();
+    event.signal = item.asSignal();
+    event.value = item.type == NotificationPayload::Value ? item.value : nullptr;
+    event.valueSize = item.type == NotificationPayload::Value ? item.valueSize : 0;
+    event.token = item.type == NotificationPayload::Request ? item.request.token : 0;
+    handler(event, ctx);
+}
+
+void Notification::dispatchTask(void* param) {
+    Dispatcher* dispatcher = static_cast<Dispatcher*>(param);
+    Notification* self = dispatcher->owner;
+    uint16_t index;
+    
+    // Keeps draining without blocking while indices are queued, so a burst costs one wakeup
+    while (xQueueReceive(dispatcher->queue, &index, portMAX_DELAY) == pdTRUE &&
+           index != NotificationKey::INVALID) {
+        self->dispatchOne(index);
+    }
+    
+    self->dispatchRunning.fetch_sub(1);
+#if NOTIFICATION_STATIC_ALLOCATION
+    // The destructor deletes us once parked, before our stack goes away
+    vTaskSuspend(nullptr);
+#else
+    vTaskDelete(nullptr);
+#endif
+}
+
+NotificationKey Notification::registerSignalKey(const char* key) {
+    NotificationKey handle;
+    Slot* slot = lockSlot(key, true);
+    if (slot == nullptr) {
+        return handle;
+    }
+    
+    if (!slot->signalSlot) {
+        if (slot->broadcast || slot->size > 0 || slot->depth > 1 || slot->handler != nullptr ||
+            slot->persist != 0) {
+            ESP_LOGE(TAG, "Can't make signal key - key: %s, pending: %u, depth: %u",
+                     key, slot->size, slot->depth);
+            unlock(slot);
+            return handle;
+        }
+        slot->signalWord.store(SIGNAL_EMPTY);
+        slot->signalSlot = true;
+    }
+    
+    handle.index = (uint16_t)(slot - slots);
+    
+    ESP_LOGD(TAG, "Signal key registered - key: %s, handle: %u", key, handle.index);
+    
+    unlock(slot);
+    return handle;
+}
+
+size_t Notification::sendMany(const NotificationEntry* entries, size_t count) {
+    if (entries == nullptr) {
+        return 0;
+    }
+    
+    uint32_t mask = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].key.index < NOTIFICATION_MAX_KEYS) {
+            mask |= 1u << (entries[i].key.index / SHARD_KEYS);
+        }
+    }
+    
+    if (!lockShards(mask, "sendMany")) {
+        for (size_t i = 0; i < count; i++) {
+            releasePayload(entries[i].data);
+        }
+        return 0;
+    }
+    
+    size_t sent = 0;
+    for (size_t i = 0; i < count; i++) {
+        const NotificationEntry& entry = entries[i];
+        if (entry.key.index >= NOTIFICATION_MAX_KEYS || slots[entry.key.index].hash == 0 ||
+            (!entry.isSignal && slots[entry.key.index].signalSlot)) {
+            releasePayload(entry.data);
+            continue;
+        }
+        
+        Slot* slot = &slots[entry.key.index];
+        
+        NotificationItem item = entry.isSignal ? NotificationItem(entry.signal) : NotificationItem(entry.data);
+        if (storeHeld(slot, item, false)) {
+            sent++;
+        }
+    }
+    
+    ESP_LOGD(TAG, "Batch sent - %zu of %zu notifications", sent, count);
+    
+    unlockShards(mask);
+    return sent;
+}
+
+int Notification::consumeAny(const NotificationKey* keys, size_t count, void** data, TickType_t timeout_ticks) {
+    NotificationItem item;
+    int index = consumeAnyItem(keys, count, NotificationPayload::Data, timeout_ticks, item);
+    if (index >= 0 && data != nullptr) {
+        *data = item.asData();
+    }
+    return index;
+}
+
+int Notification::signalAny(const NotificationKey* keys, size_t count, int* signal, TickType_t timeout_ticks) {
+    NotificationItem item;
+    int index = consumeAnyItem(keys, count, NotificationPayload::Signal, timeout_ticks, item);
+    if (index >= 0 && signal != nullptr) {
+        *signal = item.asSignal();
+    }
+    return index;
+}
+
+int Notification::waitAny(const NotificationKey* keys, size_t count, TickType_t timeout_ticks) {
+    if (keys == nullptr || count == 0 || count > UINT16_MAX) {
+        return -1;
+    }
+    
+    uint32_t mask = shardsOf(keys, count);
+    if (!lockShards(mask, "waitAny")) {
+        return -1;
+    }
+    
+    Waiter waiter = {};
+    waiter.keys = keys;
+    waiter.keyCount = (uint16_t)count;
+    int index = block(waiter, timeout_ticks);
+    
+    unlockShards(mask);
+    return index;
+}
+
+int Notification::consumeAnyItem(const NotificationKey* keys, size_t count, NotificationPayload type,
+                                 TickType_t timeout_ticks, NotificationItem& item) {
+    if (keys == nullptr || count == 0 || count > UINT16_MAX) {
+        return -1;
+    }
+    
+    uint32_t mask = shardsOf(keys, count);
+    if (!lockShards(mask, "consumeAny")) {
+        return -1;
+    }
+    
+    Waiter waiter = {};
+    waiter.keys = keys;
+    waiter.keyCount = (uint16_t)count;
+    waiter.payload = type;      // An item of another type would be lost, the caller can't see it
+    
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    
+    while (true) {
+        int index = block(waiter, timeout_ticks);
+        if (index < 0) {
+            break;
+        }
+        
+        Slot* slot = &slots[keys[index].index];
+        if (slot->signalSlot) {
+            // A lock-free consumer may have claimed it since, wait on what's left
+            int32_t value = takeSignal(slot);
+            if (value == SIGNAL_EMPTY) {
+                if (xTaskCheckForTimeOut(&timeout, &timeout_ticks) == pdTRUE) {
+                    break;
+                }
+                continue;
+            }
+            item = NotificationItem((int)value);
+            countStat(slot, &NotificationStats::consumes);
+            trace(NotificationTraceType::Consume, slot);
+        } else {
+            item = takeHeld(slot);
+        }
+        
+        ESP_LOGD(TAG, "Notification consumed - key: %s, data: %p, signal: %d",
+                 slot->key, item.asData(), item.asSignal());
+        
+        unlockShards(mask);
+        return index;
+    }
+    
+    unlockShards(mask);
+    return -1;
+}
+
+bool Notification::setBroadcastMode(const char* key, size_t history) {
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && setQueueModeHeld(slot, history, NotificationOverflow::DropOldest, 0, true);
+}
+
+bool Notification::setBroadcastMode(NotificationKey key, size_t history) {
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && setQueueModeHeld(slot, history, NotificationOverflow::DropOldest, 0, true);
+}
+
+bool Notification::openCursor(const char* key, NotificationCursor& cursor, bool latest_only) {
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && openCursorHeld(slot, cursor, latest_only);
+}
+
+bool Notification::openCursor(NotificationKey key, NotificationCursor& cursor, bool latest_only) {
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && openCursorHeld(slot, cursor, latest_only);
+}
+
+bool Notification::openCursorHeld(Slot* slot, NotificationCursor& cursor, bool latest_only) {
+    if (!slot->broadcast) {
+        ESP_LOGE(TAG, "Not a broadcast key: %s", slot->key);
+        unlock(slot);
+        return false;
+    }
+    
+    cursor.key.index = (uint16_t)(slot - slots);
+    cursor.seq = slot->size > 0 ? slot->seq - 1 : slot->seq;
+    cursor.missed = 0;
+    cursor.latestOnly = latest_only;
+    
+    unlock(slot);
+    return true;
+}
+
+bool Notification::read(NotificationCursor& cursor, void** data, TickType_t timeout_ticks) {
+    NotificationItem item;
+    if (!readItem(cursor, timeout_ticks, item)) {
+        return false;
+    }
+    if (data != nullptr) {
+        *data = item.asData();
+    }
+    return true;
+}
+
+bool Notification::readSignal(NotificationCursor& cursor, int* signal, TickType_t timeout_ticks) {
+    NotificationItem item;
+    if (!readItem(cursor, timeout_ticks, item)) {
+        return false;
+    }
+    if (signal != nullptr) {
+        *signal = item.asSignal();
+    }
+    return true;
+}
+
+bool Notification::readItem(NotificationCursor& cursor, TickType_t timeout_ticks, NotificationItem& item) {
+    Slot* slot = lockSlot(cursor.key);
+    if (slot == nullptr) {
+        return false;
+    }
+    
+    if (!slot->broadcast) {
+        unlock(slot);
+        return false;
+    }
+    
+    Waiter waiter = {};
+    waiter.slot = slot;
+    waiter.seq = cursor.seq;
+    waiter.reader = true;
+    if (block(waiter, timeout_ticks) < 0) {
+        unlock(slot);
+        return false;
+    }
+    
+    // History holds sequence numbers [oldest, seq)
+    uint32_t oldest = slot->seq - slot->size;
+    uint32_t next = cursor.latestOnly ? slot->seq - 1 : cursor.seq;
+    if ((int32_t)(next - oldest) < 0) {
+        cursor.missed += oldest - next;
+        next = oldest;
+    }
+    cursor.seq = next;
+    
+    item = slot->queue[(slot->head + (next - oldest)) % slot->depth];
+    
+    // The history keeps its reference, the reader gets its own. At saturation the
+    // cursor stays on this update, so the read can be retried once other readers release
+    if (!retainPayload(item.asData())) {
+        ESP_LOGW(TAG, "Pool block reference count saturated - key: %s", slot->key);
+        unlock(slot);
+        return false;
+    }
+    cursor.seq = next + 1;
+    countLatency(slot, item);
+    trace(NotificationTraceType::Consume, slot);
+    
+    ESP_LOGD(TAG, "Broadcast read - key: %s, seq: %lu", slot->key, (unsigned long)next);
+    
+    unlock(slot);
+    return true;
+}
+
+Notification::NotificationItem* Notification::allocQueue(size_t depth) {
+#if NOTIFICATION_STATIC_ALLOCATION
+    // Keys in different shards can race here, so claim the range with a CAS
+    uint16_t used = queueArenaUsed.load();
+    do {
+        if (depth > (size_t)(NOTIFICATION_STATIC_QUEUE_ITEMS - used)) {
+            ESP_LOGE(TAG, "Static queue arena exhausted - used: %u, requested: %zu", used, depth);
+            return nullptr;
+        }
+    } while (!queueArenaUsed.compare_exchange_weak(used, (uint16_t)(used + depth)));
+    return &queueArena[used];
+#else
+    // Rings are only touched by tasks under the shard lock, so big ones may go to PSRAM
+    NotificationItem* queue = (NotificationItem*)notificationMalloc(depth * sizeof(NotificationItem));
+    for (size_t i = 0; queue != nullptr && i < depth; i++) {
+        new (&queue[i]) NotificationItem();
+    }
+    return queue;
+#endif
+}
+
+bool Notification::setQueueModeHeld(Slot* slot, size_t depth, NotificationOverflow overflow,
+                                    TickType_t block_ticks, bool broadcast) {
+    if (slot->signalSlot || slot->size > 0 || depth > UINT16_MAX || (broadcast && slot->handler != nullptr) ||
+        slot->persist != 0) {
+        ESP_LOGE(TAG, "Can't set queue mode - key: %s, pending: %u, depth: %zu",
+                 slot->key, slot->size, depth);
+        unlock(slot);
+        return false;
+    }
+    
+    // Depth 1 keeps the single inline item, deeper rings keep their storage while they fit
+    if (depth > 1 && depth > slot->capacity) {
+        NotificationItem* queue = allocQueue(depth);
+        if (queue == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate queue - key: %s, depth: %zu", slot->key, depth);
+            unlock(slot);
+            return false;
+        }
+#if !NOTIFICATION_STATIC_ALLOCATION
+        if (slot->capacity > 0) {
+            heap_caps_free(slot->queue);
+        }
+#endif
+        slot->queue = queue;
+        slot->capacity = (uint16_t)depth;
+    }
+    slot->depth = depth > 1 ? (uint16_t)depth : 1;
+    slot->head = 0;
+    slot->overflow = overflow;
+    slot->blockTicks = block_ticks;
+    slot->broadcast = broadcast;
+    
+    ESP_LOGD(TAG, "%s mode set - key: %s, depth: %u",
+             broadcast ? "Broadcast" : "Queue", slot->key, slot->depth);
+    
+    unlock(slot);
+    return true;
+}
+
+bool Notification::sendHeld(Slot* slot, const NotificationItem& item, bool can_block) {
+    bool sent = storeHeld(slot, item, can_block);
+    
+    if (sent && slot->handler != nullptr && slot->dispatch == NotificationDispatch::Inline && hasData(slot)) {
+        // Run the handler in the sender's context, outside the lock so it can send too
+        NotificationItem taken = takeHeld(slot);
+        NotificationHandler handler = slot->handler;
+        void* ctx = slot->handlerCtx;
+        uint16_t index = (uint16_t)(slot - slots);
+        slot->delivering.fetch_add(1);
+        unlock(slot);
+        
+        deliver(handler, ctx, index, taken);
+        slot->delivering.fetch_sub(1);
+        return true;
+    }
+    
+    unlock(slot);
+    return sent;
+}
+
+bool Notification::storeHeld(Slot* slot, const NotificationItem& item, bool can_block) {
+    if (slot->signalSlot) {
+        if (item.type != NotificationPayload::Signal || item.ttl != 0) {
+            ESP_LOGE(TAG, "Signal keys only take ints without a TTL: %s", slot->key);
+            releasePayload(item.asData());
+            return false;
+        }
+        if (!publishSignal(slot, item.signal)) {
+            return false;
+        }
+        wakeWaiters(slot, false);
+        return true;
+    }
+    
+    // Expired items shouldn't take up room a live one needs
+    expireHeld(slot);
+    
+    if (slot->broadcast) {
+        // Overwrite the oldest update, history isn't counted as pending
+        if (slot->size == slot->depth) {
+            releasePayload(slot->queue[slot->head].asData());
+            slot->head = (slot->head + 1) % slot->depth;
+            slot->size--;
+            countStat(slot, &NotificationStats::overwrites);
+        }
+        slot->queue[(slot->head + slot->size) % slot->depth] = item;
+        slot->size++;
+        slot->seq++;
+        trackExpiry(slot, item);
+        countStat(slot, &NotificationStats::sends);
+        trace(NotificationTraceType::Send, slot);
+        
+        ESP_LOGD(TAG, "Broadcast sent - key: %s, seq: %lu", slot->key, (unsigned long)slot->seq);
+        
+        wakeWaiters(slot, false);
+        return true;
+    }
+    
+    bool dirty = slot->size == 0;
+    if (slot->size == slot->depth) {
+        switch (slot->overflow) {
+        case NotificationOverflow::DropOldest:
+            // A newcomer ranked below everything pending is the one that goes
+            if (slot->depth > 1 && item.priority < slot->queue[(slot->head + slot->size - 1) % slot->depth].priority) {
+                ESP_LOGD(TAG, "Queue full of higher priority items, dropping new notification - key: %s", slot->key);
+                releasePayload(item.asData());
+                countStat(slot, &NotificationStats::drops);
+                return false;
+            }
+            releasePayload(evict(slot).asData());
+            countStat(slot, &NotificationStats::overwrites);
+            ESP_LOGD(TAG, "Notification overwritten - key: %s", slot->key);
+            break;
+            
+        case NotificationOverflow::DropNewest:
+            ESP_LOGD(TAG, "Queue full, dropping new notification - key: %s", slot->key);
+            releasePayload(item.asData());
+            countStat(slot, &NotificationStats::drops);
+            return false;
+            
+        case NotificationOverflow::Block:
+            if (!can_block || !waitFor(slot, true, slot->blockTicks)) {
+                ESP_LOGW(TAG, "Queue full, send timed out - key: %s", slot->key);
+                releasePayload(item.asData());
+                countStat(slot, &NotificationStats::drops);
+                return false;
+            }
+            dirty = slot->size == 0;
+            break;
+        }
+    }
+    
+    push(slot, item);
+    countStat(slot, &NotificationStats::sends);
+    trace(NotificationTraceType::Send, slot);
+#if NOTIFICATION_PERSIST_KEYS > 0
+    if (slot->persist != 0) {
+        persistHeld(slot, item);
+    }
+#endif
+    
+    ESP_LOGD(TAG, "Notification sent - key: %s, data: %p, signal: %d",
+             slot->key, item.asData(), item.asSignal());
+    
+    // Inline handlers only run from a plain task-side send(), the one caller that may block
+    if (slot->handler != nullptr && (slot->dispatch == NotificationDispatch::Deferred || !can_block)) {
+        queueDispatch(slot);
+    }
+    
+    signalArrival(slot, dirty);
+    return true;
+}
+
+NotificationStatus Notification::consumeHeld(Slot* slot, NotificationPayload type, TickType_t timeout_ticks, NotificationItem& item) {
+    if (slot->broadcast) {
+        ESP_LOGE(TAG, "Can't consume broadcast key, use read(): %s", slot->key);
+        unlock(slot);
+        return NotificationStatus::Rejected;
+    }
+    
+    if (slot->signalSlot && type != NotificationPayload::Signal) {
+        ESP_LOGE(TAG, "Signal key only holds ints: %s", slot->key);
+        unlock(slot);
+        return NotificationStatus::Rejected;
+    }
+    
+    NotificationStatus missing = timeout_ticks == 0 ? NotificationStatus::Empty : NotificationStatus::Timeout;
+    
+    if (slot->signalSlot) {
+        int32_t value = claimSignalHeld(slot, timeout_ticks);
+        unlock(slot);
+        if (value == SIGNAL_EMPTY) {
+            return missing;
+        }
+        item = NotificationItem((int)value);
+        return NotificationStatus::Ok;
+    }
+    
+    if (!waitFor(slot, false, timeout_ticks)) {
+        unlock(slot);
+        return missing;
+    }
+    
+    // The tag is checked before taking, a mismatch leaves the item for its real consumer
+    if (slot->queue[slot->head].type != type) {
+        ESP_LOGW(TAG, "Payload type mismatch - key: %s, pending: %u, expected: %u",
+                 slot->key, (unsigned)slot->queue[slot->head].type, (unsigned)type);
+        unlock(slot);
+        return NotificationStatus::Rejected;
+    }
+    
+    item = takeHeld(slot);
+    
+    ESP_LOGD(TAG, "Notification consumed - key: %s, data: %p, signal: %d",
+             slot->key, item.asData(), item.asSignal());
+    
+    unlock(slot);
+    return NotificationStatus::Ok;
+}
+
+bool Notification::waitUntilHeld(Slot* slot, Waiter& waiter, int* signal, TickType_t timeout_ticks) {
+    // A queue's head never changes under a waiter that doesn't consume, so only single values qualify
+    if (slot->broadcast || (!slot->signalSlot && slot->depth > 1)) {
+        ESP_LOGE(TAG, "waitUntil() needs a signal or latest-value key: %s", slot->key);
+        unlock(slot);
+        return false;
+    }
+    waiter.slot = slot;
+    
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    int32_t value = 0;
+    bool met = false;
+    
+    while (block(waiter, timeout_ticks) >= 0) {
+        // Lock-free signal() consumers can take the value after the check, so look again
+        if (peekSignal(slot, value) && conditionMet(waiter, value)) {
+            met = true;
+            break;
+        }
+        if (xTaskCheckForTimeOut(&timeout, &timeout_ticks) == pdTRUE) {
+            break;
+        }
+    }
+    unlock(slot);
+    
+    if (met && signal != nullptr) {
+        *signal = (int)value;
+    }
+    return met;
+}
+
+bool Notification::waitHeld(Slot* slot, TickType_t timeout_ticks) {
+    bool arrived = waitFor(slot, false, timeout_ticks);
+    unlock(slot);
+    return arrived;
+}
+
+uint32_t Notification::hashKey(const char* key) {
+    return notificationHash(key);
+}
+
+size_t Notification::shardOfHash(uint32_t hash) {
+    return notificationHomeSlot(hash) / SHARD_KEYS;
+}
+
+Notification::Slot* Notification::findSlot(const char* key, uint32_t hash) {
+    Slot* shard = &slots[shardOfHash(hash) * SHARD_KEYS];
+    size_t index = notificationHomeSlot(hash) & (SHARD_KEYS - 1);
+    
+    for (size_t probe = 0; probe < SHARD_KEYS; probe++) {
+        Slot* slot = &shard[index];
+        if (slot->hash == 0) {
+            return nullptr;
+        }
+        if (slot->hash == hash && strcmp(slot->key, key) == 0) {
+            return slot;
+        }
+        index = (index + 1) & (SHARD_KEYS - 1);
+    }
+    
+    return nullptr;
+}
+
+Notification::Slot* Notification::internSlot(const char* key, uint32_t hash) {
+    size_t length = strlen(key);
+    if (length >= NOTIFICATION_KEY_MAX_LEN) {
+        ESP_LOGE(TAG, "Key too long (max %d): %s", NOTIFICATION_KEY_MAX_LEN - 1, key);
+        return nullptr;
+    }
+    
+    Slot* shard = &slots[shardOfHash(hash) * SHARD_KEYS];
+    size_t index = notificationHomeSlot(hash) & (SHARD_KEYS - 1);
+    
+    for (size_t probe = 0; probe < SHARD_KEYS; probe++) {
+        Slot* slot = &shard[index];
+        if (slot->hash == 0) {
+            claimSlot(slot, key, hash, length);
+            return slot;
+        }
+        if (slot->hash == hash && strcmp(slot->key, key) == 0) {
+            return slot;
+        }
+        index = (index + 1) & (SHARD_KEYS - 1);
+    }
+    
+    ESP_LOGE(TAG, "Key shard full (%d keys), dropping: %s", (int)SHARD_KEYS, key);
+    return nullptr;
+}
+
+void Notification::claimSlot(Slot* slot, const char* key, uint32_t hash, size_t length) {
+    slot->hash = hash;
+    slot->queue = &slot->item;
+    slot->depth = 1;
+    slot->overflow = NotificationOverflow::DropOldest;
+    memcpy(slot->key, key, length + 1);
+    slot->patterns = matchPatterns(slot->key);
+    bindPattern(slot);
+}
+
+Notification::Slot* Notification::lockSlot(const char* key, bool intern) {
+    NotificationStatus status;
+    return tryLockSlot(key, intern, lockTimeout.load(std::memory_order_relaxed), status);
+}
+
+Notification::Slot* Notification::lockSlot(NotificationKey key) {
+    NotificationStatus status;
+    return tryLockSlot(key, lockTimeout.load(std::memory_order_relaxed), status);
+}
+
+Notification::Slot* Notification::tryLockSlot(const char* key, bool intern, TickType_t lock_ticks,
+                                              NotificationStatus& status) {
+    status = NotificationStatus::Rejected;
+    if (key == nullptr) {
+        return nullptr;
+    }
+    
+    uint32_t hash = hashKey(key);
+    size_t shard = shardOfHash(hash);
+    if (shards[shard].mutex == nullptr) {
+        return nullptr;
+    }
+    
+    if (xSemaphoreTake(shards[shard].mutex, lock_ticks) != pdTRUE) {
+        // A try that finds the lock busy is expected, only a timed out wait is an error
+        if (lock_ticks > 0) {
+            ESP_LOGE(TAG, "Failed to take mutex for key: %s", key);
+        }
+        countStat(nullptr, &NotificationStats::lockFailures);
+        status = NotificationStatus::Contended;
+        return nullptr;
+    }
+    trace(NotificationTraceType::Lock, (uint16_t)shard);
+    
+    drainIsrQueue(shard);
+    
+    Slot* slot = intern ? internSlot(key, hash) : findSlot(key, hash);
+    if (slot == nullptr) {
+        xSemaphoreGive(shards[shard].mutex);
+        // Only looked up, so a key that was never sent is just empty
+        status = intern ? NotificationStatus::Rejected : NotificationStatus::Empty;
+        return nullptr;
+    }
+    status = NotificationStatus::Ok;
+    return slot;
+}
+
+Notification::Slot* Notification::tryLockSlot(NotificationKey key, TickType_t lock_ticks,
+                                              NotificationStatus& status) {
+    status = NotificationStatus::Rejected;
+    if (key.index >= NOTIFICATION_MAX_KEYS) {
+        return nullptr;
+    }
+    
+    Slot* slot = &slots[key.index];
+    size_t shard = shardOf(slot);
+    if (shards[shard].mutex == nullptr) {
+        return nullptr;
+    }
+    
+    if (xSemaphoreTake(shards[shard].mutex, lock_ticks) != pdTRUE) {
+        if (lock_ticks > 0) {
+            ESP_LOGE(TAG, "Failed to take mutex for handle: %u", key.index);
+        }
+        countStat(slot, &NotificationStats::lockFailures);
+        status = NotificationStatus::Contended;
+        return nullptr;
+    }
+    trace(NotificationTraceType::Lock, (uint16_t)shard);
+    
+    drainIsrQueue(shard);
+    
+    if (slot->hash == 0) {
+        // Not a handle returned by registerKey()
+        unlock(slot);
+        return nullptr;
+    }
+    status = NotificationStatus::Ok;
+    return slot;
+}
+
+void Notification::unlock(Slot* slot) {
+    xSemaphoreGive(shards[shardOf(slot)].mutex);
+}
+
+uint32_t Notification::shardsOf(const NotificationKey* keys, size_t count) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (keys[i].index < NOTIFICATION_MAX_KEYS) {
+            mask |= 1u << (keys[i].index / SHARD_KEYS);
+        }
+    }
+    return mask;
+}
+
+uint32_t Notification::shardsOf(const Waiter& waiter) {
+    if (waiter.pattern != 0) {
+        return ALL_SHARDS;
+    }
+    if (waiter.slot != nullptr) {
+        return 1u << shardOf(waiter.slot);
+    }
+    return shardsOf(waiter.keys, waiter.keyCount);
+}
+
+bool Notification::lockShards(uint32_t mask, const char* operation) {
+    // Always in ascending order, so multi-shard callers can't deadlock each other
+    for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+        if (!(mask & (1u << s))) {
+            continue;
+        }
+        if (shards[s].mutex == nullptr ||
+            xSemaphoreTake(shards[s].mutex, lockTimeout.load(std::memory_order_relaxed)) != pdTRUE) {
+            ESP_LOGE(TAG, "Failed to take mutex for %s", operation);
+            countStat(nullptr, &NotificationStats::lockFailures);
+            unlockShards(mask & ((1u << s) - 1));
+            return false;
+        }
+        trace(NotificationTraceType::Lock, (uint16_t)s);
+    }
+    
+    drainShards(mask);
+    return true;
+}
+
+void Notification::unlockShards(uint32_t mask) {
+    for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+        if (mask & (1u << s)) {
+            xSemaphoreGive(shards[s].mutex);
+        }
+    }
+}
+
+void Notification::drainShards(uint32_t mask) {
+    for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+        if (mask & (1u << s)) {
+            drainIsrQueue(s);
+        }
+    }
+}
+
+void Notification::push(Slot* slot, const NotificationItem& item) {
+    // Kept in priority order, FIFO among equals. Nothing moves while every item is priority 0
+    uint16_t at = slot->size;
+    while (at > 0 && slot->queue[(slot->head + at - 1) % slot->depth].priority < item.priority) {
+        slot->queue[(slot->head + at) % slot->depth] = slot->queue[(slot->head + at - 1) % slot->depth];
+        at--;
+    }
+    slot->queue[(slot->head + at) % slot->depth] = item;
+    slot->size++;
+    shards[shardOf(slot)].pendingCount++;
+    trackExpiry(slot, item);
+}
+
+Notification::NotificationItem Notification::pop(Slot* slot) {
+    NotificationItem item = slot->queue[slot->head];
+    slot->head = (slot->head + 1) % slot->depth;
+    slot->size--;
+    shards[shardOf(slot)].pendingCount--;
+    return item;
+}
+
+Notification::NotificationItem Notification::evict(Slot* slot) {
+    // The oldest of the lowest priority, which is the head unless priorities differ
+    uint8_t lowest = slot->queue[(slot->head + slot->size - 1) % slot->depth].priority;
+    uint16_t at = 0;
+    while (slot->queue[(slot->head + at) % slot->depth].priority > lowest) {
+        at++;
+    }
+    if (at == 0) {
+        return pop(slot);
+    }
+    
+    NotificationItem item = slot->queue[(slot->head + at) % slot->depth];
+    for (uint16_t i = at; i + 1 < slot->size; i++) {
+        slot->queue[(slot->head + i) % slot->depth] = slot->queue[(slot->head + i + 1) % slot->depth];
+    }
+    slot->size--;
+    shards[shardOf(slot)].pendingCount--;
+    return item;
+}
+
+void Notification::drop(Slot* slot) {
+    for (uint16_t i = 0; i < slot->size; i++) {
+        releasePayload(slot->queue[(slot->head + i) % slot->depth].asData());
+    }
+    if (!slot->broadcast) {
+        shards[shardOf(slot)].pendingCount -= slot->size;
+    }
+    slot->size = 0;
+    slot->head = 0;
+    slot->wakePending = false;
+    setExpiry(slot, 0);
+    
+    // Release producers blocked on a full queue
+    if (slot->overflow == NotificationOverflow::Block) {
+        wakeWaiters(slot, true);
+    }
+}
+
+bool Notification::sendValue(NotificationKey key, const void* value, size_t size) {
+    if (value == nullptr || size == 0 || size > NOTIFICATION_INLINE_PAYLOAD_SIZE) {
+        ESP_LOGE(TAG, "Invalid inline payload size: %zu (max %d)", size, NOTIFICATION_INLINE_PAYLOAD_SIZE);
+        return false;
+    }
+    
+    NotificationItem item(value, size);
+    if (handOff(key, item)) {
+        return true;
+    }
+    
+    Slot* slot = lockSlot(key);
+    if (slot == nullptr) {
+        return false;
+    }
+    
+    if (slot->signalSlot) {
+        ESP_LOGE(TAG, "Can't send value to signal key: %s", slot->key);
+        unlock(slot);
+        return false;
+    }
+    return sendHeld(slot, item);
+}
+
+bool Notification::consumeValue(NotificationKey key, void* value, size_t size, TickType_t timeout_ticks) {
+    if (value == nullptr) {
+        return false;
+    }
+    
+    Slot* slot = lockSlot(key);
+    if (slot == nullptr) {
+        return false;
+    }
+    
+    if (slot->signalSlot || slot->broadcast || !waitFor(slot, false, timeout_ticks)) {
+        unlock(slot);
+        return false;
+    }
+    
+    // Check the oldest item before taking it, a mismatch leaves it for its real consumer
+    const NotificationItem& head = slot->queue[slot->head];
+    if (head.type != NotificationPayload::Value || head.valueSize != size) {
+        ESP_LOGE(TAG, "Inline payload mismatch - key: %s, sent: %u bytes, expected: %zu",
+                 slot->key, head.type == NotificationPayload::Value ? head.valueSize : 0, size);
+        unlock(slot);
+        return false;
+    }
+    
+    NotificationItem item;
+    if (consumeHeld(slot, NotificationPayload::Value, 0, item) != NotificationStatus::Ok) {
+        return false;
+    }
+    memcpy(value, item.value, size);
+    return true;
+}
+
+bool Notification::request(const char* key, void* data, void** response, TickType_t timeout_ticks) {
+    Slot* slot = lockSlot(key, true);
+    if (slot == nullptr) {
+        releasePayload(data);
+        return false;
+    }
+    return requestHeld(slot, data, response, timeout_ticks);
+}
+
+bool Notification::request(NotificationKey key, void* data, void** response, TickType_t timeout_ticks) {
+    Slot* slot = lockSlot(key);
+    if (slot == nullptr) {
+        releasePayload(data);
+        return false;
+    }
+    return requestHeld(slot, data, response, timeout_ticks);
+}
+
+bool Notification::requestHeld(Slot* slot, void* data, void** response, TickType_t timeout_ticks) {
+    if (slot->signalSlot || slot->broadcast) {
+        ESP_LOGE(TAG, "Can't send a request to %s key: %s", slot->signalSlot ? "signal" : "broadcast", slot->key);
+        unlock(slot);
+        releasePayload(data);
+        return false;
+    }
+    
+    int index = -1;
+    uint32_t token = 0;
+    portENTER_CRITICAL(&waiterLock);
+    for (int i = 0; i < NOTIFICATION_MAX_REQUESTS; i++) {
+        if (replies[i].task == nullptr) {
+            // The sequence tells a late reply for an earlier request on this record apart, never 0
+            requestSeq = (requestSeq % 0xFFFFFF) + 1;
+            token = (requestSeq << 8) | (uint32_t)i;
+            replies[i].task = xTaskGetCurrentTaskHandle();
+            replies[i].token = token;
+            replies[i].data = nullptr;
+            replies[i].replied = false;
+            index = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&waiterLock);
+    
+    if (index < 0) {
+        ESP_LOGE(TAG, "Too many requests waiting, can't send to: %s", slot->key);
+        unlock(slot);
+        releasePayload(data);
+        return false;
+    }
+    
+    NotificationItem item(data);
+    item.type = NotificationPayload::Request;
+    item.request.data = data;
+    item.request.token = token;
+    
+    bool sent = sendHeld(slot, item);
+    
+    // The reply targets this task directly, no lock is held while waiting for it
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    bool replied = false;
+    
+    while (sent) {
+        portENTER_CRITICAL(&waiterLock);
+        replied = replies[index].replied;
+        portEXIT_CRITICAL(&waiterLock);
+        
+        if (replied || xTaskCheckForTimeOut(&timeout, &timeout_ticks) == pdTRUE) {
+            break;
+        }
+        // Other wakes share this notification index, so loop on the record, not the wake
+        ulTaskNotifyTakeIndexed(NOTIFICATION_NOTIFY_INDEX, pdTRUE, timeout_ticks);
+    }
+    
+    // A reply can still land between the timeout and here, so decide under the lock
+    portENTER_CRITICAL(&waiterLock);
+    replied = replies[index].replied;
+    void* answer = replies[index].data;
+    replies[index].task = nullptr;
+    portEXIT_CRITICAL(&waiterLock);
+    
+    if (!replied) {
+        ESP_LOGD(TAG, "No reply to request - token: %08lx", (unsigned long)token);
+        return false;
+    }
+    
+    if (response != nullptr) {
+        *response = answer;
+    }
+    return true;
+}
+
+bool Notification::consumeRequest(const char* key, NotificationRequest& request, TickType_t timeout_ticks) {
+    Slot* slot = lockSlot(key, true);
+    return slot != nullptr && consumeRequestHeld(slot, request, timeout_ticks);
+}
+
+bool Notification::consumeRequest(NotificationKey key, NotificationRequest& request, TickType_t timeout_ticks) {
+    Slot* slot = lockSlot(key);
+    return slot != nullptr && consumeRequestHeld(slot, request, timeout_ticks);
+}
+
+bool Notification::consumeRequestHeld(Slot* slot, NotificationRequest& request, TickType_t timeout_ticks) {
+    NotificationItem item;
+    if (consumeHeld(slot, NotificationPayload::Request, timeout_ticks, item) != NotificationStatus::Ok) {
+        return false;
+    }
+    request.token = item.request.token;
+    request.data = item.request.data;
+    return true;
+}
+
+bool Notification::reply(uint32_t token, void* data) {
+    size_t index = token & 0xFF;
+    TaskHandle_t task = nullptr;
+    
+    if (index < NOTIFICATION_MAX_REQUESTS) {
+        portENTER_CRITICAL(&waiterLock);
+        Reply& record = replies[index];
+        if (record.task != nullptr && record.token == token && !record.replied) {
+            record.data = data;
+            record.replied = true;
+            task = record.task;
+        }
+        portEXIT_CRITICAL(&waiterLock);
+    }
+    
+    if (task == nullptr) {
+        ESP_LOGD(TAG, "Requester gone, reply dropped - token: %08lx", (unsigned long)token);
+        releasePayload(data);
+        return false;
+    }
+    
+    xTaskNotifyGiveIndexed(task, NOTIFICATION_NOTIFY_INDEX);
+    return true;
+}
+
+bool Notification::attachPool(NotificationPool* pool) {
+    if (pool == nullptr) {
+        return false;
+    }
+    
+    // Pools are read without the mutex, attach them before sending
+    for (size_t i = 0; i < NOTIFICATION_MAX_POOLS; i++) {
+        if (pools[i] == pool) {
+            return true;
+        }
+        if (pools[i] == nullptr) {
+            pools[i] = pool;
+            return true;
+        }
+    }
+    
+    ESP_LOGE(TAG, "Too many pools attached (max %d)", NOTIFICATION_MAX_POOLS);
+    return false;
+}
+
+void Notification::release(void* data) {
+    releasePayload(data);
+}
+
+// Reached from sendFromISR(), so it stays in IRAM along with the pool calls it makes
+void IRAM_ATTR Notification::releasePayload(void* data) {
+    if (data == nullptr) {
+        return;
+    }
+    for (size_t i = 0; i < NOTIFICATION_MAX_POOLS && pools[i] != nullptr; i++) {
+        if (pools[i]->owns(data)) {
+            pools[i]->release(data);
+            return;
+        }
+    }
+}
+
+bool Notification::retainPayload(void* data) {
+    if (data == nullptr) {
+        return true;
+    }
+    for (size_t i = 0; i < NOTIFICATION_MAX_POOLS && pools[i] != nullptr; i++) {
+        if (pools[i]->owns(data)) {
+            return pools[i]->retain(data);
+        }
+    }
+    return true;    // Not pool memory, nothing to count
+}
+
+bool Notification::getStats(NotificationStats& stats) {
+    return statsFor(nullptr, stats);
+}
+
+bool Notification::getStats(const char* key, NotificationStats& stats) {
+    Slot* slot = lockSlot(key, false);
+    if (slot == nullptr) {
+        stats = NotificationStats();
+        return false;
+    }
+    unlock(slot);
+    return statsFor(slot, stats);
+}
+
+bool Notification::getStats(NotificationKey key, NotificationStats& stats) {
+    if (key.index >= NOTIFICATION_MAX_KEYS || slots[key.index].hash == 0) {
+        stats = NotificationStats();
+        return false;
+    }
+    return statsFor(&slots[key.index], stats);
+}
+
+void Notification::resetStats() {
+#if NOTIFICATION_ENABLE_STATS
+    // Counters are updated with relaxed atomics, a racing increment may survive the reset
+    globalStats = NotificationStats();
+    for (size_t i = 0; i < NOTIFICATION_MAX_KEYS; i++) {
+        keyStats[i] = NotificationStats();
+    }
+#endif
+}
+
+bool Notification::statsFor(Slot* slot, NotificationStats& stats) {
+#if NOTIFICATION_ENABLE_STATS
+    const NotificationStats& source = slot != nullptr ? keyStats[slot - slots] : globalStats;
+    
+    // Field by field so every counter is read atomically
+    stats.sends = __atomic_load_n(&source.sends, __ATOMIC_RELAXED);
+    stats.consumes = __atomic_load_n(&source.consumes, __ATOMIC_RELAXED);
+    stats.overwrites = __atomic_load_n(&source.overwrites, __ATOMIC_RELAXED);
+    stats.drops = __atomic_load_n(&source.drops, __ATOMIC_RELAXED);
+    stats.expirations = __atomic_load_n(&source.expirations, __ATOMIC_RELAXED);
+    stats.timeouts = __atomic_load_n(&source.timeouts, __ATOMIC_RELAXED);
+    stats.lockFailures = __atomic_load_n(&source.lockFailures, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < NOTIFICATION_STATS_BUCKETS; i++) {
+        stats.latency[i] = __atomic_load_n(&source.latency[i], __ATOMIC_RELAXED);
+    }
+    return true;
+#else
+    (void)slot;
+    stats = NotificationStats();
+    return false;
+#endif
+}
+
+void IRAM_ATTR Notification::countStat(Slot* slot, uint32_t NotificationStats::* counter) {
+#if NOTIFICATION_ENABLE_STATS
+    // Relaxed atomics, signal slots count without the mutex
+    __atomic_fetch_add(&(globalStats.*counter), 1, __ATOMIC_RELAXED);
+    if (slot != nullptr) {
+        __atomic_fetch_add(&(keyStats[slot - slots].*counter), 1, __ATOMIC_RELAXED);
+    }
+#else
+    (void)slot;
+    (void)counter;
+#endif
+}
+
+void Notification::countLatency(Slot* slot, const NotificationItem& item) {
+#if NOTIFICATION_ENABLE_STATS
+    countStat(slot, &NotificationStats::consumes);
+    
+    uint32_t latency = (uint32_t)esp_timer_get_time() - item.sentUs;
+    size_t bucket = 0;
+    while (bucket < NOTIFICATION_STATS_BUCKETS - 1 && latency >= (16u << (2 * bucket))) {
+        bucket++;
+    }
+    __atomic_fetch_add(&globalStats.latency[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&keyStats[slot - slots].latency[bucket], 1, __ATOMIC_RELAXED);
+#else
+    (void)slot;
+    (void)item;
+#endif
+}
+
+size_t Notification::getTrace(NotificationTraceEvent* events, size_t max_events) {
+#if NOTIFICATION_ENABLE_TRACE
+    if (events == nullptr) {
+        return 0;
+    }
+    
+    uint32_t head = traceHead.load(std::memory_order_acquire);
+    uint32_t count = head < NOTIFICATION_TRACE_EVENTS ? head : NOTIFICATION_TRACE_EVENTS;
+    if (count > max_events) {
+        count = (uint32_t)max_events;
+    }
+    
+    // The newest count events, in the order they were claimed
+    for (uint32_t i = 0; i < count; i++) {
+        events[i] = traceRing[(head - count + i) & (NOTIFICATION_TRACE_EVENTS - 1)];
+    }
+    return count;
+#else
+    (void)events;
+    (void)max_events;
+    return 0;
+#endif
+}
+
+void Notification::dumpTrace() {
+#if NOTIFICATION_ENABLE_TRACE
+    static const char* const TYPES[] = {
+        "send", "send_isr", "consume", "wait", "wake", "timeout", "lock", "handoff"
+    };
+    
+    // One event at a time, a full copy of the ring would not fit on most stacks
+    uint32_t head = traceHead.load(std::memory_order_acquire);
+    uint32_t count = head < NOTIFICATION_TRACE_EVENTS ? head : NOTIFICATION_TRACE_EVENTS;
+    for (uint32_t i = 0; i < count; i++) {
+        NotificationTraceEvent event = traceRing[(head - count + i) & (NOTIFICATION_TRACE_EVENTS - 1)];
+        const char* type = (size_t)event.type < sizeof(TYPES) / sizeof(TYPES[0]) ? TYPES[(size_t)event.type] : "?";
+        
+        // Key name last, it may contain spaces
+        if (event.type == NotificationTraceType::Lock) {
+            printf("TRACE %lu %u %s %p shard %u\n", (unsigned long)event.timeUs, event.core,
+                   type, event.task, event.key);
+        } else if (event.key < NOTIFICATION_MAX_KEYS && slots[event.key].hash != 0) {
+            printf("TRACE %lu %u %s %p key %s\n", (unsigned long)event.timeUs, event.core,
+                   type, event.task, slots[event.key].key);
+        } else {
+            printf("TRACE %lu %u %s %p any -\n", (unsigned long)event.timeUs, event.core,
+                   type, event.task);
+        }
+    }
+#endif
+}
+
+#if NOTIFICATION_TRACE_SYSVIEW
+void IRAM_ATTR Notification::traceSysView(NotificationTraceType type, uint16_t key) {
+    SEGGER_SYSVIEW_RecordU32x2(traceModule.EventOffset + (uint32_t)type, key, (uint32_t)xPortGetCoreID());
+}
+#endif
+
+bool Notification::hasData(Slot* slot) {
+    if (slot->signalSlot) {
+        return slot->signalWord.load() != SIGNAL_EMPTY;
+    }
+    expireHeld(slot);
+    return slot->size > 0;
+}
+
+bool Notification::hasData(Slot* slot, NotificationPayload type) {
+    if (!hasData(slot)) {
+        return false;
+    }
+    if (type == NotificationPayload::None) {
+        return true;
+    }
+    return slot->signalSlot ? type == NotificationPayload::Signal : slot->queue[slot->head].type == type;
+}
+
+bool Notification::peekSignal(Slot* slot, int32_t& value) {
+    if (slot->signalSlot) {
+        value = slot->signalWord.load();
+        return value != SIGNAL_EMPTY;
+    }
+    if (!hasData(slot) || slot->queue[slot->head].type != NotificationPayload::Signal) {
+        return false;
+    }
+    value = slot->queue[slot->head].signal;
+    return true;
+}
+
+bool IRAM_ATTR Notification::compareSignal(NotificationCompare compare, int32_t value, int32_t threshold) {
+    switch (compare) {
+    case NotificationCompare::Equal:    return value == threshold;
+    case NotificationCompare::NotEqual: return value != threshold;
+    case NotificationCompare::Below:    return value < threshold;
+    case NotificationCompare::AtMost:   return value <= threshold;
+    case NotificationCompare::Above:    return value > threshold;
+    case NotificationCompare::AtLeast:  return value >= threshold;
+    }
+    return false;
+}
+
+bool Notification::conditionMet(const Waiter& waiter, int32_t value) {
+    if (waiter.predicate != nullptr) {
+        return waiter.predicate((int)value, waiter.predicateCtx);
+    }
+    return compareSignal(waiter.compare, value, waiter.threshold);
+}
+
+bool Notification::expired(const NotificationItem& item, TickType_t now) {
+    return item.ttl != 0 && (TickType_t)(now - item.timestamp) >= item.ttl;
+}
+
+TickType_t Notification::expiryOf(const NotificationItem& item) {
+    // 0 means "never", an expiry that wraps onto it fires a tick late
+    TickType_t expires = item.timestamp + item.ttl;
+    return expires != 0 ? expires : 1;
+}
+
+size_t Notification::wheelBucket(TickType_t expires) {
+    return (expires / TTL_RESOLUTION) & (NOTIFICATION_TTL_WHEEL_SIZE - 1);
+}
+
+void Notification::trackExpiry(Slot* slot, const NotificationItem& item) {
+    if (item.ttl != 0) {
+        scheduleAt(slot, expiryOf(item));
+    }
+}
+
+void Notification::scheduleAt(Slot* slot, TickType_t tick) {
+    tick = tick != 0 ? tick : 1;
+    if (slot->nextExpiry == 0 || (int32_t)(tick - slot->nextExpiry) < 0) {
+        setExpiry(slot, tick);
+    }
+}
+
+void Notification::signalArrival(Slot* slot, bool dirty) {
+    if (!slot->coalesce) {
+        wakeWaiters(slot, false);
+        return;
+    }
+    
+    // Plain waiters only sleep on an empty key, but a waitUntil() sleeps on a
+    // value that failed its condition, so an overwrite has to be checked for those
+    if (!dirty && !slot->wakePending && slot->waiting.load() == 0) {
+        return;
+    }
+    
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wakeAt = slot->lastWake + slot->coalesceTicks;
+    if (slot->coalesceTicks == 0 || (int32_t)(now - wakeAt) >= 0) {
+        slot->wakePending = false;
+        slot->lastWake = now;
+        wakeWaiters(slot, false);
+    } else if (!slot->wakePending) {
+        // Sent by the next send past wakeAt, or by the reaper if none comes
+        slot->wakePending = true;
+        scheduleAt(slot, wakeAt);
+    }
+}
+
+void Notification::setExpiry(Slot* slot, TickType_t expires) {
+    Shard& shard = shards[shardOf(slot)];
+    uint16_t index = (uint16_t)(slot - slots);
+    
+    if (slot->nextExpiry != 0) {
+        if (slot->wheelPrev != NotificationKey::INVALID) {
+            slots[slot->wheelPrev].wheelNext = slot->wheelNext;
+        } else {
+            shard.wheel[wheelBucket(slot->nextExpiry)] = slot->wheelNext;
+        }
+        if (slot->wheelNext != NotificationKey::INVALID) {
+            slots[slot->wheelNext].wheelPrev = slot->wheelPrev;
+        }
+    }
+    
+    slot->nextExpiry = expires;
+    if (expires == 0) {
+        return;
+    }
+    
+    // Push at the bucket head, so a reap walking this bucket won't revisit it
+    size_t bucket = wheelBucket(expires);
+    slot->wheelPrev = NotificationKey::INVALID;
+    slot->wheelNext = shard.wheel[bucket];
+    if (slot->wheelNext != NotificationKey::INVALID) {
+        slots[slot->wheelNext].wheelPrev = index;
+    }
+    shard.wheel[bucket] = index;
+    
+    if (!reaperStarted && reaper != nullptr && xTimerStart(reaper, 0) == pdPASS) {
+        reaperStarted = true;
+    }
+}
+
+void Notification::expireHeld(Slot* slot) {
+    TickType_t now = xTaskGetTickCount();
+    if (slot->nextExpiry == 0 || (int32_t)(now - slot->nextExpiry) < 0) {
+        return;
+    }
+    
+    // Compact the ring, keeping live items in order
+    TickType_t next = 0;
+    uint16_t kept = 0;
+    uint16_t size = slot->size;
+    for (uint16_t i = 0; i < size; i++) {
+        NotificationItem& item = slot->queue[(slot->head + i) % slot->depth];
+        // Broadcast history must stay contiguous for cursors, so it expires oldest first
+        if (expired(item, now) && (!slot->broadcast || kept == 0)) {
+            releasePayload(item.asData());
+            countStat(slot, &NotificationStats::expirations);
+            continue;
+        }
+        if (kept != i) {
+            slot->queue[(slot->head + kept) % slot->depth] = item;
+        }
+        kept++;
+        if (item.ttl != 0 && (next == 0 || (int32_t)(expiryOf(item) - next) < 0)) {
+            next = expiryOf(item);
+        }
+    }
+    
+    slot->size = kept;
+    if (!slot->broadcast) {
+        shards[shardOf(slot)].pendingCount -= size - kept;
+    }
+    
+    // Flush a coalesced wake whose interval has passed
+    if (slot->wakePending) {
+        TickType_t wakeAt = slot->lastWake + slot->coalesceTicks;
+        if ((int32_t)(now - wakeAt) >= 0) {
+            slot->wakePending = false;
+            slot->lastWake = now;
+            if (slot->size > 0) {
+                wakeWaiters(slot, false);
+            }
+        } else if (next == 0 || (int32_t)(wakeAt - next) < 0) {
+            next = wakeAt != 0 ? wakeAt : 1;
+        }
+    }
+    setExpiry(slot, next);
+    
+    if (kept < size) {
+        ESP_LOGD(TAG, "Expired %u notifications - key: %s", size - kept, slot->key);
+        if (slot->overflow == NotificationOverflow::Block) {
+            wakeWaiters(slot, true);
+        }
+    }
+}
+
+void Notification::reap() {
+    TickType_t now = xTaskGetTickCount();
+    uint32_t tick = now / TTL_RESOLUTION;
+    
+    for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+        Shard& shard = shards[s];
+        
+        // Never block the timer task, a busy shard is caught up next period
+        if (shard.mutex == nullptr || xSemaphoreTake(shard.mutex, 0) != pdTRUE) {
+            continue;
+        }
+        
+        // Backstop for ISR items when no task touches the shard and the dispatch post failed
+        drainIsrQueue(s);
+        
+        // Only the buckets that elapsed since the last run, at most one revolution
+        uint32_t steps = tick - shard.wheelTick + 1;
+        if (steps > NOTIFICATION_TTL_WHEEL_SIZE) {
+            steps = NOTIFICATION_TTL_WHEEL_SIZE;
+        }
+        for (uint32_t i = 0; i < steps; i++) {
+            uint16_t index = shard.wheel[(shard.wheelTick + i) & (NOTIFICATION_TTL_WHEEL_SIZE - 1)];
+            while (index != NotificationKey::INVALID) {
+                Slot* slot = &slots[index];
+                index = slot->wheelNext;
+                expireHeld(slot);   // Due a later revolution: stays put
+            }
+        }
+        shard.wheelTick = tick;
+        
+        xSemaphoreGive(shard.mutex);
+    }
+}
+
+void Notification::reapTimer(TimerHandle_t timer) {
+    static_cast<Notification*>(pvTimerGetTimerID(timer))->reap();
+}
+
+void Notification::reaperDrained(void* self, uint32_t) {
+    static_cast<Notification*>(self)->reaperStopped.store(true);
+}
+
+bool IRAM_ATTR Notification::publishSignal(Slot* slot, int signal) {
+    if (signal == SIGNAL_EMPTY) {
+        // sendFromISR() lands here too, and logging isn't safe from an interrupt
+        if (!xPortInIsrContext()) {
+            ESP_LOGE(TAG, "INT32_MIN is reserved on signal key: %s", slot->key);
+        }
+        return false;
+    }
+    
+    // Latest value wins; one CAS publishes it to both cores
+    int32_t previous = slot->signalWord.load(std::memory_order_relaxed);
+    while (!slot->signalWord.compare_exchange_weak(previous, signal)) {
+    }
+    
+    if (previous == SIGNAL_EMPTY) {
+        signalPending.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        countStat(slot, &NotificationStats::overwrites);
+    }
+    countStat(slot, &NotificationStats::sends);
+    trace(NotificationTraceType::Send, slot);
+    return true;
+}
+
+int32_t Notification::takeSignal(Slot* slot) {
+    int32_t value = slot->signalWord.exchange(SIGNAL_EMPTY);
+    if (value != SIGNAL_EMPTY) {
+        signalPending.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return value;
+}
+
+int32_t Notification::claimSignalHeld(Slot* slot, TickType_t timeout_ticks) {
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    
+    while (true) {
+        int32_t value = takeSignal(slot);
+        if (value != SIGNAL_EMPTY) {
+            countStat(slot, &NotificationStats::consumes);
+            trace(NotificationTraceType::Consume, slot);
+            ESP_LOGD(TAG, "Notification consumed - key: %s, signal: %d", slot->key, (int)value);
+            return value;
+        }
+        
+        // Another lock-free consumer may claim it first, so keep waiting on what's left
+        if (xTaskCheckForTimeOut(&timeout, &timeout_ticks) == pdTRUE ||
+            !waitFor(slot, false, timeout_ticks)) {
+            return SIGNAL_EMPTY;
+        }
+    }
+}
+
+bool Notification::waitFor(Slot* slot, bool space, TickType_t timeout_ticks) {
+    Waiter waiter = {};
+    waiter.slot = slot;
+    waiter.space = space;
+    return block(waiter, timeout_ticks) >= 0;
+}
+
+int Notification::block(const Waiter& waiter, TickType_t timeout_ticks) {
+    uint32_t mask = shardsOf(waiter);
+    TimeOut_t timeout;
+    vTaskSetTimeOutState(&timeout);
+    int record = -1;
+    bool registered = false;
+    int ready;
+    
+    while ((ready = readyIndex(waiter)) < 0) {
+        if (xTaskCheckForTimeOut(&timeout, &timeout_ticks) == pdTRUE) {
+            removeWaiter(record);
+            countStat(waiter.slot, &NotificationStats::timeouts);
+            trace(NotificationTraceType::Timeout, waiter.slot);
+            ESP_LOGD(TAG, "Timeout waiting for notification: %s",
+                     waiter.slot != nullptr ? waiter.slot->key : "(any)");
+            return -1;
+        }
+        
+        if (!registered) {
+            // Drain once more after registering, an ISR send before that saw no waiter
+            record = addWaiter(waiter);
+            registered = true;
+            drainShards(mask);
+            continue;
+        }
+        unlockShards(mask);
+        
+        if (record >= 0) {
+            // Sleep until send() wakes us - a wake that races the give above stays pending
+            trace(NotificationTraceType::WaitStart, waiter.slot);
+            ulTaskNotifyTakeIndexed(NOTIFICATION_NOTIFY_INDEX, pdTRUE, timeout_ticks);
+            trace(NotificationTraceType::Wake, waiter.slot);
+        } else {
+            // Registry full, fall back to polling
+            vTaskDelay(1);
+        }
+        
+        // Must get the locks back so the waiter record is always released
+        for (size_t s = 0; s < NOTIFICATION_SHARDS; s++) {
+            if (mask & (1u << s)) {
+                xSemaphoreTake(shards[s].mutex, portMAX_DELAY);
+                trace(NotificationTraceType::Lock, (uint16_t)s);
+            }
+        }
+        drainShards(mask);
+    }
+    
+    removeWaiter(record);
+    return ready;
+}
+
+int Notification::readyIndex(const Waiter& waiter) {
+    if (waiter.slot != nullptr) {
+        Slot* slot = waiter.slot;
+        bool ready;
+        if (waiter.space) {
+            expireHeld(slot);
+            ready = slot->size < slot->depth;
+        } else if (waiter.reader) {
+            expireHeld(slot);
+            ready = slot->size > 0 && slot->seq != waiter.seq;
+        } else if (waiter.conditional) {
+            int32_t value;
+            ready = peekSignal(slot, value) && conditionMet(waiter, value);
+        } else {
+            ready = hasData(slot);
+        }
+        return ready ? 0 : -1;
+    }
+    
+    if (waiter.pattern != 0) {
+        // Returns the slot index itself, pattern waiters hold every shard lock
+        int best = -1;
+        for (size_t i = 0; i < NOTIFICATION_MAX_KEYS; i++) {
+            if ((slots[i].patterns & waiter.pattern) && !slots[i].signalSlot &&
+                !slots[i].broadcast && hasData(&slots[i], waiter.payload) &&
+                (best < 0 || slots[i].priority > slots[best].priority)) {
+                best = (int)i;
+            }
+        }
+        return best;
+    }
+    
+    // Broadcast keys never drain, so they can't take part in consumeAny()
+    int best = -1;
+    for (uint16_t i = 0; i < waiter.keyCount; i++) {
+        uint16_t index = waiter.keys[i].index;
+        if (index < NOTIFICATION_MAX_KEYS && slots[index].hash != 0 &&
+            !slots[index].broadcast && hasData(&slots[index], waiter.payload) &&
+            (best < 0 || slots[index].priority > slots[waiter.keys[best].index].priority)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int Notification::addWaiter(const Waiter& waiter) {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    int index = -1;
+    
+    // Shared by every shard, so even the free-record search needs the spinlock
+    portENTER_CRITICAL(&waiterLock);
+    for (int i = 0; i < NOTIFICATION_MAX_WAITERS; i++) {
+        if (waiters[i].task == nullptr) {
+            waiters[i] = waiter;
+            waiters[i].task = task;
+            index = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&waiterLock);
+    
+    if (index >= 0) {
+        countWaiting(waiter, 1);
+        return index;
+    }
+    
+    ESP_LOGW(TAG, "Waiter registry full, polling for: %s",
+             waiter.slot != nullptr ? waiter.slot->key : "(any)");
+    return -1;
+}
+
+void Notification::removeWaiter(int index) {
+    if (index < 0) {
+        return;
+    }
+    
+    countWaiting(waiters[index], -1);
+    
+    portENTER_CRITICAL(&waiterLock);
+    waiters[index] = Waiter();
+    portEXIT_CRITICAL(&waiterLock);
+}
+
+void Notification::countWaiting(const Waiter& waiter, int delta) {
+    // Pattern waiters skip signal keys, which are the only ones reading the count
+    if (waiter.pattern != 0) {
+        return;
+    }
+    if (waiter.slot != nullptr) {
+        waiter.slot->waiting.fetch_add(delta);
+        return;
+    }
+    
+    for (uint16_t i = 0; i < waiter.keyCount; i++) {
+        uint16_t index = waiter.keys[i].index;
+        if (index < NOTIFICATION_MAX_KEYS) {
+            slots[index].waiting.fetch_add(delta);
+        }
+    }
+}
+
+bool IRAM_ATTR Notification::matches(const Waiter& waiter, Slot* slot, bool space) {
+    if (waiter.task == nullptr || waiter.space != space) {
+        return false;
+    }
+    if (waiter.pattern != 0) {
+        return (slot->patterns & waiter.pattern) != 0;
+    }
+    if (waiter.slot != nullptr) {
+        return waiter.slot == slot;
+    }
+    
+    uint16_t index = (uint16_t)(slot - slots);
+    for (uint16_t i = 0; i < waiter.keyCount; i++) {
+        if (waiter.keys[i].index == index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool IRAM_ATTR Notification::sendFromISR(NotificationKey key, void* data, BaseType_t* higherPriorityTaskWoken) {
+    if (key.index < NOTIFICATION_MAX_KEYS && slots[key.index].signalSlot) {
+        releasePayload(data);
+        return false;
+    }
+    
+    // Built field by field, the tagged constructors read the tick count the task way
+    NotificationItem item;
+    item.data = data;
+    item.type = NotificationPayload::Data;
+    item.timestamp = xTaskGetTickCountFromISR();
+    return pushFromISR(key, item, higherPriorityTaskWoken);
+}
+
+bool IRAM_ATTR Notification::sendFromISR(NotificationKey key, int signal, BaseType_t* higherPriorityTaskWoken) {
+    if (key.index < NOTIFICATION_MAX_KEYS && slots[key.index].signalSlot) {
+        // Signal slots need no draining, publish straight into the word
+        Slot* slot = &slots[key.index];
+        if (!publishSignal(slot, signal)) {
+            return false;
+        }
+        wakeWaitersFromISR(slot, higherPriorityTaskWoken);
+        return true;
+    }
+    
+    NotificationItem item;
+    item.signal = signal;
+    item.type = NotificationPayload::Signal;
+    item.timestamp = xTaskGetTickCountFromISR();
+    return pushFromISR(key, item, higherPriorityTaskWoken);
+}
+
+bool IRAM_ATTR Notification::pushRing(uint16_t index, const NotificationItem& item) {
+    // Claim a cell - producers on either core race on isrEnqueue only
+    Shard& shard = shards[index / SHARD_KEYS];
+    uint32_t pos = shard.isrEnqueue.load(std::memory_order_relaxed);
+    IsrEntry* entry;
+    while (true) {
+        entry = &shard.isrQueue[pos & (NOTIFICATION_ISR_QUEUE_LEN - 1)];
+        int32_t diff = (int32_t)(entry->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (shard.isrEnqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;   // Ring full
+        } else {
+            pos = shard.isrEnqueue.load(std::memory_order_relaxed);
+        }
+    }
+    
+    entry->slot = index;
+    entry->item = item;
+    entry->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool IRAM_ATTR Notification::pushFromISR(NotificationKey key, const NotificationItem& item, BaseType_t* higherPriorityTaskWoken) {
+    if (key.index >= NOTIFICATION_MAX_KEYS || slots[key.index].hash == 0 || !pushRing(key.index, item)) {
+        releasePayload(item.asData());
+        return false;
+    }
+    trace(NotificationTraceType::SendFromISR, key.index);
+    Shard& shard = shards[key.index / SHARD_KEYS];
+    
+    // Wake waiters directly, they drain the ring once they hold the shard lock
+    Slot* slot = &slots[key.index];
+    wakeWaitersFromISR(slot, higherPriorityTaskWoken);
+    
+    // A handler has no task of its own to drain the ring, so hand the shard to the pool
+    if (slot->handler != nullptr && shard.drainQueued.exchange(1) == 0) {
+        uint16_t drain = DISPATCH_DRAIN | (uint16_t)(key.index / SHARD_KEYS);
+        QueueHandle_t queue = dispatchQueue(slot);
+        if (queue == nullptr || xQueueSendFromISR(queue, &drain, higherPriorityTaskWoken) != pdTRUE) {
+            shard.drainQueued.exchange(0);   // reap() picks it up next period
+        }
+    }
+    return true;
+}
+
+bool Notification::handOff(NotificationKey key, const NotificationItem& item) {
+    if (key.index >= NOTIFICATION_MAX_KEYS) {
+        return false;
+    }
+    
+    // Only a key pinned to the other core, and only policies the drain can apply without blocking or failing
+    Slot* slot = &slots[key.index];
+    if (slot->affinity == 0 || slot->affinity - 1 == xPortGetCoreID() || slot->hash == 0 || slot->signalSlot ||
+        slot->coalesce || slot->overflow != NotificationOverflow::DropOldest || xPortInIsrContext()) {
+        return false;
+    }
+    if (!pushRing(key.index, item)) {
+        return false;   // Full, the locked path drains it first so order is kept
+    }
+    trace(NotificationTraceType::Handoff, key.index);
+    
+    // One cross-core wake per batch, the woken consumer drains everything queued since
+    if (!slot->handoffPending.exchange(true)) {
+        wakeSignalWaiters(slot);
+    }
+    
+    Shard& shard = shards[key.index / SHARD_KEYS];
+    if (slot->handler != nullptr && shard.drainQueued.exchange(1) == 0) {
+        uint16_t drain = DISPATCH_DRAIN | (uint16_t)(key.index / SHARD_KEYS);
+        QueueHandle_t queue = dispatchQueue(slot);
+        if (queue == nullptr || xQueueSend(queue, &drain, 0) != pdTRUE) {
+            shard.drainQueued.exchange(0);   // reap() picks it up next period
+        }
+    }
+    return true;
+}
+
+bool IRAM_ATTR Notification::wakesWithoutLock(const Waiter& waiter, Slot* slot) {
+    if (!matches(waiter, slot, false)) {
+        return false;
+    }
+    // Only a signal slot's word is readable here, other conditions are left to the waiter
+    if (waiter.conditional && waiter.predicate == nullptr && slot->signalSlot) {
+        int32_t value = slot->signalWord.load();
+        return value != SIGNAL_EMPTY && compareSignal(waiter.compare, value, waiter.threshold);
+    }
+    return true;
+}
+
+void IRAM_ATTR Notification::wakeWaitersFromISR(Slot* slot, BaseType_t* higherPriorityTaskWoken) {
+    portENTER_CRITICAL_ISR(&waiterLock);
+    for (int i = 0; i < NOTIFICATION_MAX_WAITERS; i++) {
+        if (wakesWithoutLock(waiters[i], slot)) {
+            vTaskNotifyGiveIndexedFromISR(waiters[i].task, NOTIFICATION_NOTIFY_INDEX, higherPriorityTaskWoken);
+        }
+    }
+    portEXIT_CRITICAL_ISR(&waiterLock);
+}
+
+void Notification::wakeSignalWaiters(Slot* slot) {
+    // Notified under the spinlock like the ISR path, so the tasks can't go away without the shard lock
+    portENTER_CRITICAL(&waiterLock);
+    for (int i = 0; i < NOTIFICATION_MAX_WAITERS; i++) {
+        if (wakesWithoutLock(waiters[i], slot)) {
+            xTaskNotifyGiveIndexed(waiters[i].task, NOTIFICATION_NOTIFY_INDEX);
+        }
+    }
+    portEXIT_CRITICAL(&waiterLock);
+}
+
+void Notification::drainIsrQueue(size_t shard) {
+    Shard& ring = shards[shard];
+    bool rechecked = false;
+    while (true) {
+        IsrEntry* entry = &ring.isrQueue[ring.isrDequeue & (NOTIFICATION_ISR_QUEUE_LEN - 1)];
+        if (entry->seq.load(std::memory_order_acquire) != ring.isrDequeue + 1) {
+            // Empty, or the producer hasn't finished writing this cell. A handOff() still
+            // writing may find its key's flag set by a later cell and skip the wake, so
+            // clear the shard's flags: it either wakes, or finished before this recheck
+            if (rechecked || ring.isrEnqueue.load() == ring.isrDequeue) {
+                return;
+            }
+            for (size_t i = shard * SHARD_KEYS; i < (shard + 1) * SHARD_KEYS; i++) {
+                slots[i].handoffPending.exchange(false);
+            }
+            rechecked = true;
+            continue;
+        }
+        
+        // An exchange, so a handOff() that saw the flag set finished its cell before this read
+        slots[entry->slot].handoffPending.exchange(false);
+        storeHeld(&slots[entry->slot], entry->item, false);
+        
+        entry->seq.store(ring.isrDequeue + NOTIFICATION_ISR_QUEUE_LEN, std::memory_order_release);
+        ring.isrDequeue++;
+        rechecked = false;
+    }
+}
+
+void Notification::wakeWaiters(Slot* slot, bool space) {
+    // Collect under the spinlock, notify outside it. Records matching this slot are
+    // only removed under its shard lock, which the caller holds, so the tasks stay valid
+    TaskHandle_t tasks[NOTIFICATION_MAX_WAITERS];
+    int count = 0;
+    int conditional[NOTIFICATION_MAX_WAITERS];
+    int conditionalCount = 0;
+    
+    portENTER_CRITICAL(&waiterLock);
+    for (int i = 0; i < NOTIFICATION_MAX_WAITERS; i++) {
+        if (matches(waiters[i], slot, space)) {
+            if (waiters[i].conditional) {
+                conditional[conditionalCount++] = i;
+            } else {
+                tasks[count++] = waiters[i].task;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&waiterLock);
+    
+    // Conditions run outside the spinlock, a predicate may take a while. Those
+    // records wait on this slot, so they are just as stable as the tasks above
+    int32_t value;
+    if (conditionalCount > 0 && peekSignal(slot, value)) {
+        for (int i = 0; i < conditionalCount; i++) {
+            if (conditionMet(waiters[conditional[i]], value)) {
+                tasks[count++] = waiters[conditional[i]].task;
+            }
+        }
+    }
+    
+    for (int i = 0; i < count; i++) {
+        xTaskNotifyGiveIndexed(tasks[i], NOTIFICATION_NOTIFY_INDEX);
     }
 }
@@ -1,34 +1,713 @@
 #pragma once
 
-#include <string>
-#include <map>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "NotificationConfig.h"
+
+class NotificationPool;
+
+/**
+ * @brief What send() does when a queued key is already full
+ */
+enum class NotificationOverflow : uint8_t {
+    DropOldest,     // Discard the oldest item to make room (latest-value behaviour)
+    DropNewest,     // Reject the new item, send() returns false and the caller keeps it
+    Block           // Wait for a consumer to make room, up to the block timeout
+};
+
+/**
+ * @brief Built-in conditions for Notification::waitUntil()
+ */
+enum class NotificationCompare : uint8_t {
+    Equal,          // value == threshold
+    NotEqual,       // value != threshold
+    Below,          // value < threshold
+    AtMost,         // value <= threshold
+    Above,          // value > threshold
+    AtLeast         // value >= threshold
+};
+
+/**
+ * @brief Custom condition for Notification::waitUntil()
+ * 
+ * Runs in the sending task with the key's shard lock held, so keep it short and
+ * don't call back into the Notification instance.
+ */
+typedef bool (*NotificationPredicate)(int value, void* ctx);
+
+/**
+ * @brief What a pending item carries
+ */
+enum class NotificationPayload : uint8_t {
+    None,           // Empty item
+    Data,           // void* from send(key, void*)
+    Signal,         // int from send(key, int)
+    Value,          // Inline bytes from sendValue()
+    Request         // void* from request(), with a reply token
+};
+
+/**
+ * @brief Outcome of the try*() calls
+ */
+enum class NotificationStatus : uint8_t {
+    Ok,             // Sent or consumed
+    Empty,          // Nothing pending for the key
+    Timeout,        // Waited the whole timeout and nothing arrived
+    Contended,      // Another task holds the key's shard lock
+    Rejected        // Unknown key, wrong payload type, broadcast key or full queue
+};
+
+/**
+ * @brief Handle to a pre-registered key
+ * 
+ * Returned by Notification::registerKey(). Handle based calls index the key
+ * table directly and skip hashing and string compares entirely.
+ */
+struct NotificationKey {
+    static constexpr uint16_t INVALID = 0xFFFF;
+    
+    uint16_t index = INVALID;
+    
+    bool valid() const { return index != INVALID; }
+};
+
+/**
+ * @brief FNV-1a hash of a key, the same at compile time and at run time
+ * 
+ * 0 is reserved for unused slots and maps to 1.
+ */
+constexpr uint32_t notificationHash(const char* key) {
+    uint32_t hash = 2166136261u;
+    while (*key) {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619u;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/**
+ * @brief Slot a key hashes to before any probing
+ * 
+ * High hash bits pick the shard, low bits the slot within it. Keys declared with
+ * NOTIFY_KEY_TABLE() always live in this slot, so their handles are constants.
+ */
+constexpr uint16_t notificationHomeSlot(uint32_t hash) {
+    return (uint16_t)(((hash >> 16) & (NOTIFICATION_SHARDS - 1)) * (NOTIFICATION_MAX_KEYS / NOTIFICATION_SHARDS) +
+                      (hash & (NOTIFICATION_MAX_KEYS / NOTIFICATION_SHARDS - 1)));
+}
+
+/**
+ * @brief A key known at compile time, see NotificationKeys.h
+ */
+struct NotificationKeyInfo {
+    const char* name;
+    uint32_t hash;
+};
+
+/**
+ * @brief Handle to a registered key pattern
+ * 
+ * Returned by Notification::registerPattern(). Patterns are '/' separated like
+ * keys: '+' matches exactly one segment and a trailing '#' matches the rest,
+ * so "sensor/+/1" matches "sensor/temp/1" and "sensor/#" matches everything
+ * under "sensor".
+ */
+struct NotificationPattern {
+    static constexpr uint8_t INVALID = 0xFF;
+    
+    uint8_t index = INVALID;
+    
+    bool valid() const { return index != INVALID; }
+};
+
+/**
+ * @brief Counter snapshot returned by Notification::getStats()
+ * 
+ * All zero unless built with NOTIFICATION_ENABLE_STATS=1.
+ */
+struct NotificationStats {
+    uint32_t sends;             // Items stored
+    uint32_t consumes;          // Items taken by consume/signal/read
+    uint32_t overwrites;        // Items discarded to make room for a newer one
+    uint32_t drops;             // Sends rejected by a full queue
+    uint32_t expirations;       // Items that outlived their TTL unconsumed
+    uint32_t timeouts;          // Waits that gave up
+    uint32_t lockFailures;      // Mutex takes that hit the lock timeout
+    uint32_t latency[NOTIFICATION_STATS_BUCKETS];  // Send-to-consume us, bucket i < 16 << (2 * i)
+};
+
+/**
+ * @brief What a trace event records, see Notification::getTrace()
+ */
+enum class NotificationTraceType : uint8_t {
+    Send,           // Item stored, including items drained from the ISR ring
+    SendFromISR,    // sendFromISR() queued an item
+    Consume,        // Item taken by a consumer, reader or handler
+    WaitStart,      // Task is about to sleep on a key
+    Wake,           // Sleeping task is running again
+    Timeout,        // Wait gave up
+    Lock,           // Shard mutex taken, key holds the shard number
+    Handoff         // send() from another core queued an item for a pinned key
+};
+
+/**
+ * @brief One entry of the trace ring
+ */
+struct NotificationTraceEvent {
+    uint32_t timeUs;            // esp_timer_get_time(), wraps after about 71 minutes
+    void* task;                 // Running task, nullptr in an ISR
+    uint16_t key;               // Key handle index, NotificationKey::INVALID if the wait spans keys
+    NotificationTraceType type;
+    uint8_t core;
+};
+
+/**
+ * @brief A subscriber's read position on a broadcast key
+ * 
+ * Created by Notification::openCursor(). Each subscriber keeps its own cursor,
+ * so every one of them sees every update without the producer sending copies.
+ */
+struct NotificationCursor {
+    NotificationKey key;
+    uint32_t seq = 0;           // Sequence number of the next update to read
+    uint32_t missed = 0;        // Updates that fell out of the history before they were read
+    bool latestOnly = false;    // Skip straight to the newest update on every read
+};
+
+/**
+ * @brief Where a subscribe() handler runs
+ */
+enum class NotificationDispatch : uint8_t {
+    Inline,         // In the sending task, right after send() stores the item
+    Deferred        // On the shared dispatcher task pool
+};
+
+/**
+ * @brief A delivered item, passed to subscribe() handlers
+ * 
+ * Only valid for the duration of the handler call. The handler owns data
+ * exactly like a consume() caller would (release() pool blocks).
+ */
+struct NotificationEvent {
+    NotificationKey key;
+    NotificationPayload type;
+    void* data;                 // nullptr unless type is Data or Request
+    int signal;                 // -1 unless type is Signal
+    const void* value;          // Inline payload from sendValue(), nullptr otherwise
+    size_t valueSize;
+    uint32_t token;             // Pass to reply() for Request items, 0 otherwise
+};
+
+/**
+ * @brief A request taken by consumeRequest(), answer it with reply()
+ */
+struct NotificationRequest {
+    uint32_t token;             // Correlation id, unique among requests in flight
+    void* data;
+};
+
+typedef void (*NotificationHandler)(const NotificationEvent& event, void* ctx);
+
+/**
+ * @brief One key/payload pair for Notification::sendMany()
+ */
+struct NotificationEntry {
+    NotificationKey key;
+    void* data;
+    int signal;
+    bool isSignal;
+    
+    NotificationEntry(NotificationKey k, void* d) : key(k), data(d), signal(0), isSignal(false) {}
+    NotificationEntry(NotificationKey k, int s) : key(k), data(nullptr), signal(s), isSignal(true) {}
+};
 
 /**
  * @brief A simple, FreeRTOS-native notification system based on key-value pairs
  * 
  * Similar to FreeRTOS queues/notifications but with string keys.
  * Uses void* for data like native FreeRTOS APIs.
+ * Keys live in a fixed-size hash table, so send/consume never touch the heap.
  */
 class Notification {
 private:
+    /**
+     * @brief A pending item: type tag, payload and timestamps
+     * 
+     * The payload members share storage, only the one named by type is valid.
+     * Read them through asData()/asSignal() unless the type has been checked.
+     * 
+     * The payload is NOTIFICATION_INLINE_PAYLOAD_SIZE bytes (at least 8) so inline
+     * values fit, and the TTL needs a second tick, so on the ESP32 an item is 28
+     * bytes with the default 16-byte payload, 32 with NOTIFICATION_ENABLE_STATS.
+     * The 1-byte tag, the value size and the priority share the last word, see the
+     * static_assert.
+     */
     struct NotificationItem {
-        void* data;
-        int signal;
+        union {
+            void* data;
+            int signal;
+            uint8_t value[NOTIFICATION_INLINE_PAYLOAD_SIZE > 8 ? NOTIFICATION_INLINE_PAYLOAD_SIZE : 8];
+            struct {
+                void* data;
+                uint32_t token;
+            } request;
+        };
         TickType_t timestamp;
+        TickType_t ttl;                                 // Ticks after timestamp it expires, 0 never
+        NotificationPayload type;
+        uint8_t valueSize;                              // Inline payload bytes for Value items
+        uint8_t priority;                               // Queue-mode ordering, higher is taken first
+#if NOTIFICATION_ENABLE_STATS
+        uint32_t sentUs;                                // esp_timer_get_time() at send, for latency
+#endif
         
-        NotificationItem(void* d) : data(d), timestamp(xTaskGetTickCount()) {}
-        NotificationItem(int s) : signal(s), timestamp(xTaskGetTickCount()) {}
+        NotificationItem()
+            : data(nullptr), timestamp(0), ttl(0), type(NotificationPayload::None), valueSize(0), priority(0) { stamp(); }
+        NotificationItem(void* d)
+            : data(d), timestamp(xTaskGetTickCount()), ttl(0), type(NotificationPayload::Data), valueSize(0), priority(0) {
+            stamp();
+        }
+        NotificationItem(int s)
+            : signal(s), timestamp(xTaskGetTickCount()), ttl(0), type(NotificationPayload::Signal), valueSize(0),
+              priority(0) {
+            stamp();
+        }
+        NotificationItem(const void* v, size_t size)
+            : timestamp(xTaskGetTickCount()), ttl(0), type(NotificationPayload::Value), valueSize((uint8_t)size),
+              priority(0) {
+            memcpy(value, v, size);
+            stamp();
+        }
+        
+        void* asData() const {
+            return type == NotificationPayload::Data ? data : type == NotificationPayload::Request ? request.data : nullptr;
+        }
+        int asSignal() const { return type == NotificationPayload::Signal ? signal : -1; }
+        
+        void stamp() {
+#if NOTIFICATION_ENABLE_STATS
+            sentUs = (uint32_t)esp_timer_get_time();
+#endif
+        }
+    };
+    
+    // No padding beyond the tag word: payload, two ticks, tag, size and priority, then sentUs
+    static_assert(sizeof(NotificationItem) ==
+                      ((offsetof(NotificationItem, type) + 3 + (NOTIFICATION_ENABLE_STATS ? 1 + sizeof(uint32_t) : 0) +
+                        alignof(NotificationItem) - 1) / alignof(NotificationItem)) * alignof(NotificationItem),
+                  "NotificationItem picked up padding, keep the tag, value size and priority in the last word");
+    static_assert(offsetof(NotificationItem, type) == offsetof(NotificationItem, timestamp) + 2 * sizeof(TickType_t),
+                  "NotificationItem payload and ticks must be contiguous");
+    
+    /**
+     * @brief Open-addressing table entry with inline key storage
+     * 
+     * A slot is claimed the first time its key is used and is never released,
+     * so lookups probe until the first empty slot without tombstones.
+     * Pending items live in a ring; in latest-value mode that ring is the single
+     * inline item, in queue mode it is allocated by setQueueMode() and kept while
+     * later modes fit in it.
+     */
+    struct Slot {
+        uint32_t hash;              // 0 marks an unused slot
+        NotificationItem* queue;
+        uint16_t capacity;                      // Items queue can hold, 0 while it is the inline item
+        uint16_t depth;
+        uint16_t head;
+        uint16_t size;              // Pending items
+        NotificationOverflow overflow;
+        TickType_t blockTicks;
+        uint8_t priority;                       // Higher is taken first by consumeAny()/waitAny()
+        TickType_t nextExpiry;                  // Earliest item expiry or deferred wake tick, 0 for none
+        uint16_t wheelPrev;                     // Neighbours in the shard's expiry wheel bucket
+        uint16_t wheelNext;
+        NotificationHandler handler;            // subscribe() callback, nullptr when unsubscribed
+        void* handlerCtx;
+        NotificationDispatch dispatch;
+        bool dispatchQueued;                    // Index already waiting in a dispatch queue
+        std::atomic<uint16_t> delivering;       // Handler calls taken under the lock that haven't returned
+        uint8_t affinity;                       // 1 + core the key is pinned to, 0 follows the sender
+        std::atomic<bool> handoffPending;       // Waiters woken for a handed-off item not drained yet
+        uint32_t patterns;                      // Bits of the registered patterns matching this key
+        bool coalesce;                          // Debounced wakes, see setCoalescing()
+        bool wakePending;                       // A wake held back by coalesceTicks
+        TickType_t coalesceTicks;
+        TickType_t lastWake;
+        uint8_t persist;                        // 1 + record in persistTable, 0 when not persistent
+        NotificationItem item;
+        bool broadcast;                         // Items are read through cursors, never consumed
+        uint32_t seq;                           // Broadcast updates published so far
+        bool signalSlot;                        // Lock-free signal key, see registerSignalKey()
+        std::atomic<int32_t> signalWord;        // Signal slot value, SIGNAL_EMPTY when none
+        std::atomic<uint16_t> waiting;          // Registered waiters, lets signal producers skip the mutex
+        char key[NOTIFICATION_KEY_MAX_LEN];
+    };
+    
+    /**
+     * @brief A task blocked until a key arrives
+     * 
+     * Waits on a single slot, or on any of a caller-owned key set (consumeAny/waitAny).
+     */
+    struct Waiter {
+        TaskHandle_t task;
+        Slot* slot;
+        const NotificationKey* keys;
+        uint16_t keyCount;
+        uint32_t pattern;   // Bit of the pattern waited on, 0 for slot/key set waits
+        uint32_t seq;   // Broadcast readers: the cursor position they are waiting past
+        bool reader;    // Broadcast cursor read rather than a plain data wait
+        bool space;     // Producer waiting for room rather than consumer waiting for data
+        NotificationPayload payload;        // Key set/pattern consumers: type the next item must have, None for any
+        bool conditional;                   // waitUntil(): only ready once the int passes
+        NotificationCompare compare;
+        int32_t threshold;
+        NotificationPredicate predicate;    // Used instead of compare when set
+        void* predicateCtx;
+    };
+    
+    /**
+     * @brief Cell of the bounded MPSC ring filled by sendFromISR()
+     * 
+     * seq hands a cell back and forth between producers and the draining task.
+     */
+    struct IsrEntry {
+        std::atomic<uint32_t> seq;
+        uint16_t slot;
+        NotificationItem item;
+    };
+    
+    /**
+     * @brief One partition of the key table
+     * 
+     * A key's hash picks its shard and the shard owns a contiguous run of slots.
+     * The shard mutex guards those slots, their pending count and the draining
+     * end of the shard's ring, so operations on keys in different shards never
+     * contend. ISRs and tasks on the far core of a pinned key fill the ring.
+     */
+    struct Shard {
+        SemaphoreHandle_t mutex;
+#if NOTIFICATION_STATIC_ALLOCATION
+        StaticSemaphore_t mutexBuffer;
+#endif
+        size_t pendingCount;                    // Pending items in this shard's slots
+        IsrEntry isrQueue[NOTIFICATION_ISR_QUEUE_LEN];
+        std::atomic<uint32_t> isrEnqueue;
+        uint32_t isrDequeue;
+        std::atomic<uint32_t> drainQueued;      // Nonzero while a drain turn sits in a dispatch queue
+        uint16_t wheel[NOTIFICATION_TTL_WHEEL_SIZE];  // Expiry bucket heads (slot indices)
+        uint32_t wheelTick;                     // Last wheel tick reaped
+    };
+    
+    /**
+     * @brief Node of the pattern trie, one per distinct pattern segment
+     * 
+     * Children are chained through sibling; node 0 is the root, so 0 also
+     * means "none". Exact segments are matched by hash and the full pattern is
+     * checked once a key reaches a node, so a collision can't cause a false match.
+     */
+    struct PatternNode {
+        uint32_t hash;              // FNV-1a of an exact segment
+        uint32_t patterns;          // Bits of the patterns ending at this node
+        uint8_t child;
+        uint8_t sibling;
+        uint8_t kind;               // SEGMENT_EXACT, SEGMENT_ONE ('+') or SEGMENT_REST ('#')
+    };
+    
+    struct Pattern {
+        char text[NOTIFICATION_KEY_MAX_LEN];    // Empty marks an unused record
+        NotificationHandler handler;            // Bound to matching keys without a handler of their own
+        void* handlerCtx;
+        NotificationDispatch dispatch;
+    };
+    
+    static constexpr uint8_t SEGMENT_EXACT = 0;
+    static constexpr uint8_t SEGMENT_ONE = 1;
+    static constexpr uint8_t SEGMENT_REST = 2;
+    
+    static constexpr int32_t SIGNAL_EMPTY = INT32_MIN;
+    static constexpr size_t SHARD_KEYS = NOTIFICATION_MAX_KEYS / NOTIFICATION_SHARDS;
+    static constexpr uint16_t DISPATCH_DRAIN = 0x8000;     // Dispatch queue entry: drain the ISR ring of shard (entry & ~DISPATCH_DRAIN)
+    static constexpr uint32_t ALL_SHARDS = (uint32_t)((1ull << NOTIFICATION_SHARDS) - 1);
+    
+    Slot slots[NOTIFICATION_MAX_KEYS] = {};
+    Shard shards[NOTIFICATION_SHARDS] = {};
+    std::atomic<uint32_t> signalPending{0};     // Pending signal slots, not covered by pendingCount
+    Waiter waiters[NOTIFICATION_MAX_WAITERS] = {};
+    
+    /**
+     * @brief A task in request() waiting for its reply
+     */
+    struct Reply {
+        TaskHandle_t task;                      // nullptr when free
+        uint32_t token;                         // Upper 24 bits sequence, low 8 bits this record
+        void* data;
+        bool replied;
+    };
+    
+    Reply replies[NOTIFICATION_MAX_REQUESTS] = {};
+    uint32_t requestSeq = 0;
+    
+    // Guards the waiter and reply records, which are shared by every shard and by ISRs
+    portMUX_TYPE waiterLock = portMUX_INITIALIZER_UNLOCKED;
+    
+    std::atomic<TickType_t> lockTimeout{pdMS_TO_TICKS(NOTIFICATION_LOCK_TIMEOUT_MS)};
+    
+    TimerHandle_t reaper = nullptr;             // Walks the expiry wheels, started by the first TTL send
+    bool reaperStarted = false;
+    std::atomic<bool> reaperStopped{false};     // Set by the timer task once it is done with the reaper
+#if NOTIFICATION_STATIC_ALLOCATION
+    StaticTimer_t reaperBuffer;
+#endif
+    
+    // Pattern index - written under every shard lock, so any one shard lock is enough to read it
+    Pattern patternTable[NOTIFICATION_MAX_PATTERNS] = {};
+    PatternNode patternNodes[NOTIFICATION_MAX_PATTERN_NODES] = {};
+    uint8_t patternNodeCount = 1;               // Node 0 is the root
+    
+    /**
+     * @brief A dispatch queue and the tasks serving it
+     * 
+     * One shared by all cores, or one per core with NOTIFICATION_DISPATCH_PER_CORE.
+     */
+    struct Dispatcher {
+        Notification* owner;
+        QueueHandle_t queue;                    // Slot indices with items for their handler
+        TaskHandle_t tasks[NOTIFICATION_DISPATCH_TASKS];
+#if NOTIFICATION_STATIC_ALLOCATION
+        StaticQueue_t queueBuffer;
+        uint8_t queueStorage[NOTIFICATION_DISPATCH_QUEUE_LEN * sizeof(uint16_t)];
+        StaticTask_t taskBuffers[NOTIFICATION_DISPATCH_TASKS];
+        StackType_t stacks[NOTIFICATION_DISPATCH_TASKS][NOTIFICATION_DISPATCH_STACK / sizeof(StackType_t)];
+#endif
+    };
+    
+#if NOTIFICATION_DISPATCH_PER_CORE
+    static constexpr size_t DISPATCHERS = portNUM_PROCESSORS;
+#else
+    static constexpr size_t DISPATCHERS = 1;
+#endif
+    
+    // Dispatcher pool for subscribe(), created by the first subscription
+    Dispatcher dispatchers[DISPATCHERS] = {};
+    std::atomic<int> dispatchRunning{0};
+#if NOTIFICATION_STATIC_ALLOCATION
+    // Queue mode rings, handed out front to back and never returned
+    NotificationItem queueArena[NOTIFICATION_STATIC_QUEUE_ITEMS];
+    std::atomic<uint16_t> queueArenaUsed{0};
+#endif
+    
+    NotificationPool* pools[NOTIFICATION_MAX_POOLS] = {};
+    
+#if NOTIFICATION_PERSIST_KEYS > 0
+    /**
+     * @brief Snapshot of a persistent key's last value
+     * 
+     * The RTC snapshot stores these as they are, NVS gets a packed copy.
+     */
+    struct PersistRecord {
+        uint32_t check;                         // Checksum of the rest, 0 marks an empty record
+        char key[NOTIFICATION_KEY_MAX_LEN];
+        NotificationPayload type;               // Signal or Value, None once setPersistent(false)
+        uint8_t size;
+        uint8_t value[NOTIFICATION_INLINE_PAYLOAD_SIZE > 4 ? NOTIFICATION_INLINE_PAYLOAD_SIZE : 4];
+    };
+    
+    // Written under the key's shard lock
+    struct Persisted {
+        std::atomic<bool> used;                 // Owned by a key, claimed with a CAS since shards race
+        PersistRecord record;
+        bool enabled;
+        bool dirty;                             // Changed since the last persist()
     };
     
-    std::map<std::string, NotificationItem> notifications;
-    SemaphoreHandle_t mutex;
+    Persisted persistTable[NOTIFICATION_PERSIST_KEYS] = {};
+#if NOTIFICATION_PERSIST_STORE == NOTIFICATION_PERSIST_RTC
+    static PersistRecord rtcSnapshot[NOTIFICATION_PERSIST_KEYS];
+#endif
+    
+    static uint32_t checksum(const PersistRecord& record);
+    bool setPersistentHeld(Slot* slot, bool enabled);
+    void persistHeld(Slot* slot, const NotificationItem& item);
+    void releasePersistHeld(Slot* slot);
+    void restoreRecord(const PersistRecord& record);
+    void restorePersisted();
+#endif
+    
+#if NOTIFICATION_ENABLE_STATS
+    NotificationStats globalStats = {};
+    NotificationStats keyStats[NOTIFICATION_MAX_KEYS] = {};
+#endif
+    
+#if NOTIFICATION_ENABLE_TRACE
+    NotificationTraceEvent traceRing[NOTIFICATION_TRACE_EVENTS];
+    std::atomic<uint32_t> traceHead{0};
+#endif
+#if NOTIFICATION_TRACE_SYSVIEW
+    static void traceSysView(NotificationTraceType type, uint16_t key);
+#endif
+    
+    // Trace points - no-ops unless NOTIFICATION_ENABLE_TRACE, lock-free and ISR safe
+    void trace(NotificationTraceType type, uint16_t key) {
+#if NOTIFICATION_ENABLE_TRACE
+        uint32_t pos = traceHead.fetch_add(1, std::memory_order_relaxed);
+        NotificationTraceEvent& event = traceRing[pos & (NOTIFICATION_TRACE_EVENTS - 1)];
+        event.timeUs = (uint32_t)esp_timer_get_time();
+        event.task = xPortInIsrContext() ? nullptr : xTaskGetCurrentTaskHandle();
+        event.key = key;
+        event.type = type;
+        event.core = (uint8_t)xPortGetCoreID();
+#if NOTIFICATION_TRACE_SYSVIEW
+        traceSysView(type, key);
+#endif
+#else
+        (void)type;
+        (void)key;
+#endif
+    }
+    void trace(NotificationTraceType type, const Slot* slot) {
+        trace(type, slot != nullptr ? (uint16_t)(slot - slots) : NotificationKey::INVALID);
+    }
+    
+    // Counters - no-ops unless NOTIFICATION_ENABLE_STATS, safe without any lock
+    void countStat(Slot* slot, uint32_t NotificationStats::* counter);
+    void countLatency(Slot* slot, const NotificationItem& item);
+    bool statsFor(Slot* slot, NotificationStats& stats);
     
     static const char* TAG;
     
+    static uint32_t hashKey(const char* key);
+    static size_t shardOfHash(uint32_t hash);
+    size_t shardOf(const Slot* slot) const { return (size_t)(slot - slots) / SHARD_KEYS; }
+    
+    // Key table - all expect the key's shard lock to be held
+    Slot* findSlot(const char* key, uint32_t hash);
+    Slot* internSlot(const char* key, uint32_t hash);
+    void claimSlot(Slot* slot, const char* key, uint32_t hash, size_t length);
+    
+    // Take the key's shard lock and resolve the slot, nullptr (lock released) on failure
+    Slot* lockSlot(const char* key, bool intern);
+    Slot* lockSlot(NotificationKey key);
+    
+    // Same with an explicit lock timeout, status says why it failed: Contended or Rejected
+    Slot* tryLockSlot(const char* key, bool intern, TickType_t lock_ticks, NotificationStatus& status);
+    Slot* tryLockSlot(NotificationKey key, TickType_t lock_ticks, NotificationStatus& status);
+    void unlock(Slot* slot);
+    
+    // Multi-shard locking - shard bit masks, always taken in ascending shard order
+    uint32_t shardsOf(const NotificationKey* keys, size_t count);
+    uint32_t shardsOf(const Waiter& waiter);
+    bool lockShards(uint32_t mask, const char* operation);
+    void unlockShards(uint32_t mask);
+    void drainShards(uint32_t mask);
+    
+    // Shared bodies of the string and handle APIs - expect the shard lock held and release it
+    bool sendHeld(Slot* slot, const NotificationItem& item, bool can_block = true);
+    bool storeHeld(Slot* slot, const NotificationItem& item, bool can_block);
+    NotificationStatus consumeHeld(Slot* slot, NotificationPayload type, TickType_t timeout_ticks, NotificationItem& item);
+    bool waitHeld(Slot* slot, TickType_t timeout_ticks);
+    bool requestHeld(Slot* slot, void* data, void** response, TickType_t timeout_ticks);
+    bool consumeRequestHeld(Slot* slot, NotificationRequest& request, TickType_t timeout_ticks);
+    NotificationItem* allocQueue(size_t depth);
+    bool setQueueModeHeld(Slot* slot, size_t depth, NotificationOverflow overflow,
+                          TickType_t block_ticks, bool broadcast);
+    bool openCursorHeld(Slot* slot, NotificationCursor& cursor, bool latest_only);
+    bool setCoalescingHeld(Slot* slot, bool enabled, TickType_t min_interval);
+    bool setAffinityHeld(Slot* slot, BaseType_t core);
+    bool readItem(NotificationCursor& cursor, TickType_t timeout_ticks, NotificationItem& item);
+    
+    // Ring access - expect the shard lock to be held
+    void push(Slot* slot, const NotificationItem& item);
+    NotificationItem pop(Slot* slot);
+    NotificationItem evict(Slot* slot);
+    void drop(Slot* slot);
+    bool hasData(Slot* slot);
+    bool hasData(Slot* slot, NotificationPayload type);
+    
+    // TTL expiry and deferred wakes - expect the shard lock held, reap() runs from the reaper timer
+    static bool expired(const NotificationItem& item, TickType_t now);
+    static TickType_t expiryOf(const NotificationItem& item);
+    static size_t wheelBucket(TickType_t expires);
+    void trackExpiry(Slot* slot, const NotificationItem& item);
+    void scheduleAt(Slot* slot, TickType_t tick);
+    void signalArrival(Slot* slot, bool dirty);
+    void setExpiry(Slot* slot, TickType_t expires);
+    void expireHeld(Slot* slot);
+    void reap();
+    static void reapTimer(TimerHandle_t timer);
+    static void reaperDrained(void* self, uint32_t unused);
+    
+    // Handler dispatch - queueDispatch() and takeHeld() expect the shard lock held
+    bool startDispatchers();
+    QueueHandle_t dispatchQueue(const Slot* slot);
+    void queueDispatch(Slot* slot);
+    NotificationItem takeHeld(Slot* slot);
+    void dispatchOne(uint16_t index);
+    bool subscribeHeld(Slot* slot, NotificationHandler handler, void* ctx, NotificationDispatch mode);
+    static void deliver(NotificationHandler handler, void* ctx, uint16_t index, const NotificationItem& item);
+    static void dispatchTask(void* param);
+    
+    // Patterns - all expect the shard locks held, see patternTable
+    static uint32_t hashSegment(const char* segment, size_t length);
+    static bool validPattern(const char* pattern, size_t* segments);
+    static bool patternMatches(const char* pattern, const char* key);
+    void insertPattern(const char* pattern, uint32_t bit);
+    uint32_t matchTrie(uint8_t node, const char* segment);
+    uint32_t matchPatterns(const char* key);
+    void bindPattern(Slot* slot);
+    
+    // Pool ownership - return or share blocks that belong to an attached pool
+    void releasePayload(void* data);
+    bool retainPayload(void* data);
+    
+    // Signal slots - lock-free, callable with or without the shard lock
+    bool publishSignal(Slot* slot, int signal);
+    int32_t takeSignal(Slot* slot);
+    int32_t claimSignalHeld(Slot* slot, TickType_t timeout_ticks);
+    
+    // ISR and cross-core ingestion - pushes are lock-free, drainIsrQueue() expects the shard lock held
+    bool pushRing(uint16_t index, const NotificationItem& item);
+    bool pushFromISR(NotificationKey key, const NotificationItem& item, BaseType_t* higherPriorityTaskWoken);
+    bool handOff(NotificationKey key, const NotificationItem& item);
+    void drainIsrQueue(size_t shard);
+    
+    // Waiter registry - all of these expect the locks of the waiter's shards to be held
+    int addWaiter(const Waiter& waiter);
+    void removeWaiter(int index);
+    void countWaiting(const Waiter& waiter, int delta);
+    bool matches(const Waiter& waiter, Slot* slot, bool space);
+    int readyIndex(const Waiter& waiter);
+    void wakeWaiters(Slot* slot, bool space);
+    // Lock-free wakes for ISRs, the signal fast path and handOff(), notified under waiterLock instead
+    bool wakesWithoutLock(const Waiter& waiter, Slot* slot);
+    void wakeWaitersFromISR(Slot* slot, BaseType_t* higherPriorityTaskWoken);
+    void wakeSignalWaiters(Slot* slot);
+    
+    // Conditional waits - the int waitUntil() would see on a key, and whether it passes
+    bool peekSignal(Slot* slot, int32_t& value);
+    static bool compareSignal(NotificationCompare compare, int32_t value, int32_t threshold);
+    static bool conditionMet(const Waiter& waiter, int32_t value);
+    bool waitUntilHeld(Slot* slot, Waiter& waiter, int* signal, TickType_t timeout_ticks);
+    
+    /**
+     * @brief Block until the waiter's condition holds, sleeping on the task notification
+     * 
+     * Expects the waiter's shard locks held and returns with them held.
+     * @return Index of the ready key (0 for a single slot), or -1 on timeout
+     */
+    int block(const Waiter& waiter, TickType_t timeout_ticks);
+    bool waitFor(Slot* slot, bool space, TickType_t timeout_ticks);
+    int consumeAnyItem(const NotificationKey* keys, size_t count, NotificationPayload type,
+                       TickType_t timeout_ticks, NotificationItem& item);
+    
 public:
     /**
      * @brief Constructor - initializes the notification system
@@ -40,6 +719,15 @@ public:
      */
     ~Notification();
     
+    /**
+     * @brief Heap instances always live in internal RAM
+     * 
+     * The key table and waiter records are touched on every call and from ISRs,
+     * so they stay out of PSRAM even when malloc() may return it.
+     */
+    static void* operator new(size_t size) noexcept;
+    static void operator delete(void* memory);
+    
     /**
      * @brief Send a notification with void* data (FreeRTOS style)
      * 
@@ -49,17 +737,87 @@ public:
      */
     bool send(const char* key, void* data);
     bool send(const char* key, int signal);
+    bool send(NotificationKey key, void* data);
+    bool send(NotificationKey key, int signal);
+    
+    /**
+     * @brief Send a notification that expires if it isn't consumed in time
+     * 
+     * An expired item is never delivered. It is dropped lazily when its key is
+     * next touched, and reclaimed in the background by a timer wheel so it
+     * doesn't hold queue space or count() forever.
+     * 
+     * @param key The notification key
+     * @param data Pointer to send (you manage the memory, pool blocks are released)
+     * @param ttl_ticks Ticks the item stays deliverable after the send, 0 for no expiry
+     * @param priority Place in a queue-mode ring, higher items are consumed first
+     *        and equal ones in send order. Ignored by latest-value, broadcast and signal keys
+     * @return true if sent successfully, false otherwise
+     * @note TTLs aren't supported on signal keys. Broadcast history expires oldest first
+     */
+    bool send(const char* key, void* data, TickType_t ttl_ticks, uint8_t priority = 0);
+    bool send(const char* key, int signal, TickType_t ttl_ticks, uint8_t priority = 0);
+    bool send(NotificationKey key, void* data, TickType_t ttl_ticks, uint8_t priority = 0);
+    bool send(NotificationKey key, int signal, TickType_t ttl_ticks, uint8_t priority = 0);
     
     /**
      * @brief Consume a notification by key (FreeRTOS style)
      * 
      * @param key The notification key to consume
-     * @param timeout_ms Timeout in ticks to wait for notification
+     * @param timeout_ticks Timeout in ticks to wait for notification
      * @return void* pointer to data, or nullptr if not found/timeout
      * @note You need to cast the returned void* to your expected type
+     * @note An item of another type (int, inline value) is left pending: consume()
+     *       returns nullptr and signal() returns -1 for it
+     * @note The calling task sleeps until send() wakes it, no polling
      */
     void* consume(const char* key, TickType_t timeout_ticks = pdMS_TO_TICKS(100));
     int signal(const char* key, TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    void* consume(NotificationKey key, TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    int signal(NotificationKey key, TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    
+    /**
+     * @brief Send without waiting for the shard lock or for queue space
+     * 
+     * @return Ok if stored, Contended if another task holds the key's shard lock,
+     *         Rejected if the key table, a full queue or a signal key refused it
+     * @note On Contended nothing happened and the caller still owns data, so it can
+     *       retry. On Rejected pool blocks are released like send() does. An int on
+     *       a signal key takes no lock and is never Contended
+     */
+    NotificationStatus trySend(const char* key, void* data);
+    NotificationStatus trySend(const char* key, int signal);
+    NotificationStatus trySend(NotificationKey key, void* data);
+    NotificationStatus trySend(NotificationKey key, int signal);
+    
+    /**
+     * @brief Consume with a status code instead of nullptr or -1
+     * 
+     * The shard lock is only tried, never waited for, so contention is reported
+     * at once as Contended rather than looking like a missing notification.
+     * 
+     * @param key The notification key to consume
+     * @param data Receives the payload when the result is Ok
+     * @param timeout_ticks Time to wait for an item, 0 (default) never blocks
+     * @return Ok, Empty (nothing pending and no timeout), Timeout, Contended,
+     *         or Rejected for an item of another type, which is left pending
+     */
+    NotificationStatus tryConsume(const char* key, void*& data, TickType_t timeout_ticks = 0);
+    NotificationStatus tryConsume(const char* key, int& signal, TickType_t timeout_ticks = 0);
+    NotificationStatus tryConsume(NotificationKey key, void*& data, TickType_t timeout_ticks = 0);
+    NotificationStatus tryConsume(NotificationKey key, int& signal, TickType_t timeout_ticks = 0);
+    
+    /**
+     * @brief Set how long the blocking calls wait for a contended shard lock
+     * 
+     * A call that runs out fails like a missing key (false, nullptr, -1) and
+     * counts a lockFailure. Waiting for an item is separate and uses each
+     * call's own timeout.
+     * 
+     * @param timeout_ticks Lock timeout, pdMS_TO_TICKS(NOTIFICATION_LOCK_TIMEOUT_MS) by default
+     */
+    void setLockTimeout(TickType_t timeout_ticks);
+    TickType_t getLockTimeout() const { return lockTimeout.load(std::memory_order_relaxed); }
     
     /**
      * @brief Check if a notification exists
@@ -68,25 +826,37 @@ public:
      * @return true if notification exists, false otherwise
      */
     bool has(const char* key);
+    bool has(NotificationKey key);
+    
+    /**
+     * @brief Check if the next item for a key is a signal (int)
+     * 
+     * @return true if signal() would return a value right away
+     */
     bool hasSignal(const char* key);
+    bool hasSignal(NotificationKey key);
     
     /**
      * @brief Remove a notification without consuming it
      * 
      * @param key The notification key to remove
      * @return true if removed, false if not found
+     * @note In queue mode this drops every queued item for the key
      */
     bool remove(const char* key);
     
     /**
      * @brief Clear all notifications
+     * 
+     * @note Locks, empties and releases one shard at a time, so it isn't atomic:
+     *       an item sent to a shard that was already cleared stays pending
      */
     void clear();
     
     /**
      * @brief Get number of pending notifications
      * 
-     * @return Number of notifications
+     * @return Number of notifications, a snapshot taken under every shard lock
      */
     size_t count();
     
@@ -96,6 +866,486 @@ public:
      * @param key The notification key to wait for
      * @param timeout_ticks Maximum time to wait in ticks
      * @return true if notification arrived, false if timeout
+     * @note Uses task notification NOTIFICATION_NOTIFY_INDEX of the calling task
      */
     bool wait(const char* key, TickType_t timeout_ticks = portMAX_DELAY);
+    bool wait(NotificationKey key, TickType_t timeout_ticks = portMAX_DELAY);
+    
+    /**
+     * @brief Wait until a key's int value meets a condition
+     * 
+     * The condition is checked by send() under the key's lock, so the waiter
+     * sleeps through every value that doesn't pass and wakes once for one that
+     * does. Like wait() nothing is consumed: the value stays pending, and while it
+     * still passes another waitUntil() returns at once.
+     * 
+     * @code
+     * int level;
+     * if (notification->waitUntil("battery_level", NotificationCompare::Below, 20, &level)) {
+     *     ESP_LOGW("Power", "battery low: %d", level);
+     * }
+     * @endcode
+     * 
+     * @param key A signal key or latest-value key, queue and broadcast keys are rejected
+     * @param compare How the value is compared to threshold
+     * @param threshold Value to compare against
+     * @param signal Receives the value that passed, may be nullptr
+     * @param timeout_ticks Maximum time to wait in ticks
+     * @return true if a passing value is pending, false on timeout or a rejected key
+     */
+    bool waitUntil(const char* key, NotificationCompare compare, int threshold,
+                   int* signal = nullptr, TickType_t timeout_ticks = portMAX_DELAY);
+    bool waitUntil(NotificationKey key, NotificationCompare compare, int threshold,
+                   int* signal = nullptr, TickType_t timeout_ticks = portMAX_DELAY);
+    
+    /**
+     * @brief Wait until a custom predicate accepts a key's int value
+     * 
+     * @note The predicate runs with the shard lock held, in the sending task or the
+     *       waiting one. Sends from an ISR can't run it, so they wake the waiter to check
+     */
+    bool waitUntil(const char* key, NotificationPredicate predicate, void* ctx,
+                   int* signal = nullptr, TickType_t timeout_ticks = portMAX_DELAY);
+    bool waitUntil(NotificationKey key, NotificationPredicate predicate, void* ctx,
+                   int* signal = nullptr, TickType_t timeout_ticks = portMAX_DELAY);
+    
+    /**
+     * @brief Register a key once and get a handle for the hot path
+     * 
+     * @param key The notification key to register
+     * @return Handle for the handle based overloads, invalid if the table is full
+     * @note Registering the same key again returns the same handle
+     */
+    NotificationKey registerKey(const char* key);
+    
+    /**
+     * @brief Claim the home slots of keys declared with NOTIFY_KEY_TABLE()
+     * 
+     * Call once at startup, before any string keys are sent, so no other key
+     * has probed into those slots yet. Afterwards the table's constant handles
+     * work with every handle based overload.
+     * 
+     * @return true if every key got its home slot or already had it, false if
+     *         another key got there first
+     */
+    bool installKeys(const NotificationKeyInfo* keys, size_t count);
+    
+    /**
+     * @brief Send a notification from an interrupt handler
+     * 
+     * Modeled on xQueueSendFromISR(). The item goes into a lock-free ring that is
+     * drained into the key table by the next task-side call, and tasks waiting on
+     * the key are woken directly.
+     * 
+     * @param key Handle from registerKey(), string keys can't be resolved in an ISR
+     * @param data Pointer to send (you manage the memory)
+     * @param higherPriorityTaskWoken Set to pdTRUE if a woken task should preempt,
+     *        pass it to portYIELD_FROM_ISR()
+     * @return true if queued, false if the handle is invalid or the ISR ring is full
+     * @note Queue keys using NotificationOverflow::Block drop the new item when full
+     */
+    bool sendFromISR(NotificationKey key, void* data, BaseType_t* higherPriorityTaskWoken);
+    bool sendFromISR(NotificationKey key, int signal, BaseType_t* higherPriorityTaskWoken);
+    
+    /**
+     * @brief Register a signal-only key that skips the mutex
+     * 
+     * The value lives in an atomic word: send(handle, int) publishes it with a
+     * compare-and-swap and signal(handle) claims it with an atomic exchange.
+     * The mutex is only taken to wake a task that is already blocked on the key.
+     * 
+     * @param key The notification key to register
+     * @return Handle for the handle based overloads, invalid if the key is already queued or pending
+     * @note Signal keys hold ints only, INT32_MIN is reserved and send(key, void*) is rejected
+     */
+    NotificationKey registerSignalKey(const char* key);
+    
+    /**
+     * @brief Send several notifications under a single lock
+     * 
+     * @param entries Key/payload pairs, keys from registerKey()
+     * @param count Number of entries
+     * @return Number of entries sent
+     * @note Never blocks: full NotificationOverflow::Block queues reject their entry
+     */
+    size_t sendMany(const NotificationEntry* entries, size_t count);
+    
+    /**
+     * @brief Consume whichever of several keys arrives first
+     * 
+     * @param keys Keys to wait on, must stay valid for the duration of the call
+     * @param count Number of keys
+     * @param data Receives the payload of the consumed key, may be nullptr
+     * @param timeout_ticks Timeout in ticks to wait for any of the keys
+     * @return Index into keys of the consumed key, or -1 on timeout
+     * @note Of the keys already pending, the highest setPriority() wins, ties in array order
+     * @note Like consume() and signal(), only items of the matching type are taken:
+     *       consumeAny() skips keys whose next item is an int or inline value, and
+     *       signalAny() skips pointers. Those stay pending for their own consumer
+     */
+    int consumeAny(const NotificationKey* keys, size_t count, void** data,
+                   TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    int signalAny(const NotificationKey* keys, size_t count, int* signal,
+                  TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    
+    /**
+     * @brief Wait for any of several keys without consuming it
+     * 
+     * @return Index into keys of a pending key, or -1 on timeout
+     */
+    int waitAny(const NotificationKey* keys, size_t count, TickType_t timeout_ticks = portMAX_DELAY);
+    
+    /**
+     * @brief Switch a key to broadcast (pub/sub) mode
+     * 
+     * Every send appends to a history ring and bumps the key's sequence number.
+     * Nothing is consumed; subscribers read through their own NotificationCursor.
+     * 
+     * @param key The notification key to configure
+     * @param history Updates kept for slow subscribers, allocated once here
+     * @return true if configured, false if the key has pending items or allocation failed
+     * @note consume()/signal() reject broadcast keys, use read()/readSignal()
+     */
+    bool setBroadcastMode(const char* key, size_t history = 1);
+    bool setBroadcastMode(NotificationKey key, size_t history = 1);
+    
+    /**
+     * @brief Open a subscriber cursor on a broadcast key
+     * 
+     * The cursor starts at the newest update, so it is readable right away if the
+     * key has been sent before.
+     * 
+     * @param key The broadcast key to subscribe to
+     * @param cursor Receives the cursor
+     * @param latest_only Only ever read the newest update, skipping older ones
+     * @return true if opened, false if the key is not in broadcast mode
+     */
+    bool openCursor(const char* key, NotificationCursor& cursor, bool latest_only = false);
+    bool openCursor(NotificationKey key, NotificationCursor& cursor, bool latest_only = false);
+    
+    /**
+     * @brief Read the next update for a subscriber
+     * 
+     * @param cursor The subscriber's cursor, advanced on success
+     * @param data Receives the payload, may be nullptr
+     * @param timeout_ticks Timeout in ticks to wait for an update past the cursor
+     * @return true if an update was read, false on timeout
+     * @note Updates that were overwritten before this subscriber read them are
+     *       skipped and added to cursor.missed
+     */
+    bool read(NotificationCursor& cursor, void** data, TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    bool readSignal(NotificationCursor& cursor, int* signal, TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    
+    /**
+     * @brief Send a small payload by value
+     * 
+     * The bytes are copied into the slot, so the caller needs no static or heap
+     * buffer. See TypedChannel<T> for a typed wrapper.
+     * 
+     * @param key The notification key
+     * @param value Bytes to copy
+     * @param size Number of bytes, up to NOTIFICATION_INLINE_PAYLOAD_SIZE
+     * @return true if sent successfully, false otherwise
+     */
+    bool sendValue(NotificationKey key, const void* value, size_t size);
+    
+    /**
+     * @brief Consume a payload sent with sendValue()
+     * 
+     * @param key The notification key
+     * @param value Receives the bytes
+     * @param size Expected size, must match the size that was sent
+     * @param timeout_ticks Timeout in ticks to wait for notification
+     * @return true if consumed, false on timeout or size mismatch (the item stays pending)
+     */
+    bool consumeValue(NotificationKey key, void* value, size_t size,
+                      TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    
+    /**
+     * @brief Send a request to a key and wait for its reply
+     * 
+     * The request carries a correlation token, and the reply goes straight to
+     * this task's notification, so concurrent requesters each get their own
+     * answer with a single wakeup and no reply key.
+     * 
+     * @param key Key the server consumes with consumeRequest() or a handler
+     * @param data Request payload, owned by the server once sent
+     * @param response Receives the reply payload
+     * @param timeout_ticks How long to wait for the reply
+     * @return true if a reply arrived, false if the request couldn't be sent,
+     *         NOTIFICATION_MAX_REQUESTS are already waiting, or on timeout
+     * @note A reply that arrives after the timeout is dropped by reply()
+     */
+    bool request(const char* key, void* data, void** response,
+                 TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    bool request(NotificationKey key, void* data, void** response,
+                 TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    
+    /**
+     * @brief Take the next request sent to a key with request()
+     * 
+     * @return true if a request was taken, false on timeout or if the next item
+     *         isn't a request (it stays pending)
+     */
+    bool consumeRequest(const char* key, NotificationRequest& request,
+                        TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    bool consumeRequest(NotificationKey key, NotificationRequest& request,
+                        TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    
+    /**
+     * @brief Answer a request, waking the task waiting in request()
+     * 
+     * @param token NotificationRequest::token or NotificationEvent::token
+     * @param data Reply payload, owned by the requester once delivered
+     * @return true if delivered, false if the requester already gave up
+     *         (pool blocks are released)
+     */
+    bool reply(uint32_t token, void* data);
+    
+    /**
+     * @brief Let the notification system manage blocks of a payload pool
+     * 
+     * Once attached, send() takes ownership of blocks from this pool: blocks that
+     * are overwritten, removed, cleared or rejected go back to the pool, and
+     * broadcast readers get their own reference.
+     * 
+     * @param pool Pool that outlives this instance
+     * @return true if attached, false if NOTIFICATION_MAX_POOLS are already attached
+     * @note Attach pools at startup, before any send
+     */
+    bool attachPool(NotificationPool* pool);
+    
+    /**
+     * @brief Release a consumed payload back to its pool
+     * 
+     * Does nothing for pointers that don't belong to an attached pool, so
+     * consumers can call it on every payload.
+     */
+    void release(void* data);
+    
+    /**
+     * @brief Get a snapshot of the global counters
+     * 
+     * @param stats Receives the counters
+     * @return true if stats are compiled in (NOTIFICATION_ENABLE_STATS), false otherwise
+     */
+    bool getStats(NotificationStats& stats);
+    
+    /**
+     * @brief Get a snapshot of the counters for one key
+     * 
+     * @return true if stats are compiled in and the key exists, false otherwise
+     */
+    bool getStats(const char* key, NotificationStats& stats);
+    bool getStats(NotificationKey key, NotificationStats& stats);
+    
+    /**
+     * @brief Zero all counters
+     */
+    void resetStats();
+    
+    /**
+     * @brief Copy the trace ring, oldest event first
+     * 
+     * @param events Receives up to max_events events
+     * @return Events copied, always 0 unless built with NOTIFICATION_ENABLE_TRACE
+     * @note Recording continues during the copy, so an event written meanwhile may
+     *       come out torn. Copy when traffic is quiet or ignore the newest few
+     */
+    size_t getTrace(NotificationTraceEvent* events, size_t max_events);
+    
+    /**
+     * @brief Print the trace ring as "TRACE " lines
+     * 
+     * Feed the log to tools/notification_trace.py for a Perfetto timeline.
+     */
+    void dumpTrace();
+    
+    /**
+     * @brief Switch a key to FIFO queue mode
+     * 
+     * Back-to-back sends are queued instead of overwriting each other. The ring
+     * is allocated once here, so send/consume still never allocate. Items sent
+     * with a priority are inserted ahead of lower ones, and DropOldest then
+     * discards the oldest item of the lowest priority, or the new item if it
+     * ranks below everything pending.
+     * 
+     * @param key The notification key to configure
+     * @param depth Queue depth, 1 switches back to latest-value mode
+     * @param overflow What send() does when the queue is full
+     * @param block_ticks How long a producer waits for room with NotificationOverflow::Block
+     * @return true if configured, false if the key has pending items or allocation failed
+     */
+    bool setQueueMode(const char* key, size_t depth,
+                      NotificationOverflow overflow = NotificationOverflow::DropOldest,
+                      TickType_t block_ticks = pdMS_TO_TICKS(100));
+    bool setQueueMode(NotificationKey key, size_t depth,
+                      NotificationOverflow overflow = NotificationOverflow::DropOldest,
+                      TickType_t block_ticks = pdMS_TO_TICKS(100));
+    
+    /**
+     * @brief Set a key's delivery priority
+     * 
+     * When several keys are pending, consumeAny()/signalAny()/waitAny() return
+     * the one with the highest priority instead of the first in the key array.
+     * 
+     * @param key The notification key to configure
+     * @param priority 0 (default) to 255, higher is delivered first
+     * @return true if set, false if the key can't be resolved
+     */
+    bool setPriority(const char* key, uint8_t priority);
+    bool setPriority(NotificationKey key, uint8_t priority);
+    
+    /**
+     * @brief Coalesce a high-rate key: debounce wakeups of its waiters
+     * 
+     * Sends keep overwriting the pending value in place, but waiters are only
+     * woken when the key goes from empty to pending, and at most once per
+     * min_interval. A wake held back by the interval goes out with the next send
+     * after it has passed, or from the reaper timer if the producer goes quiet.
+     * 
+     * @param key The notification key to configure
+     * @param enabled false restores a wake on every send
+     * @param min_interval Minimum ticks between wakes, 0 to only debounce to dirty transitions
+     * @return true if set, false for signal and broadcast keys
+     * @note Held-back wakes from the timer are only as precise as NOTIFICATION_TTL_RESOLUTION_MS
+     */
+    bool setCoalescing(const char* key, bool enabled, TickType_t min_interval = 0);
+    bool setCoalescing(NotificationKey key, bool enabled, TickType_t min_interval = 0);
+    
+    /**
+     * @brief Keep a key's last value across resets
+     * 
+     * Every int or inline value sent to the key is recorded, and the next
+     * Notification constructor sends it again, so consumers get the last known
+     * state right at boot. Where the snapshot lives is set by
+     * NOTIFICATION_PERSIST_STORE.
+     * 
+     * @param key The notification key, must be a latest-value key
+     * @param enabled false forgets the recorded value and frees its record, with
+     *        NVS once persist() has erased it
+     * @return true if set, false for queue, broadcast and signal keys, when
+     *         NOTIFICATION_PERSIST_KEYS keys are already persistent, or when compiled out
+     * @note Persistent keys can't be switched to queue, broadcast or signal mode later
+     */
+    bool setPersistent(const char* key, bool enabled = true);
+    bool setPersistent(NotificationKey key, bool enabled = true);
+    
+    /**
+     * @brief Write persistent keys that changed since the last call to NVS
+     * 
+     * Call it from a low-priority task on a schedule, or before esp_deep_sleep_start().
+     * The RTC snapshot is always current, so there this does nothing.
+     * 
+     * @return Number of keys written
+     */
+    size_t persist();
+    
+    /**
+     * @brief Call a handler for every item sent to a key, instead of running a consumer task
+     * 
+     * Deferred handlers run on a small shared pool of NOTIFICATION_DISPATCH_TASKS
+     * tasks, created by the first subscribe(). Inline handlers run in the sending
+     * task straight after send(), outside the lock; items that arrive through
+     * sendFromISR() or sendMany() are handed to the pool instead.
+     * 
+     * @param key The notification key to subscribe to
+     * @param handler Called once per item, which it consumes
+     * @param ctx Passed through to the handler
+     * @param mode Where the handler runs
+     * @return true if subscribed, false for signal/broadcast keys or if the pool can't start
+     * @note One handler per key, subscribing again replaces it. Pending items are
+     *       delivered right away
+     */
+    bool subscribe(const char* key, NotificationHandler handler, void* ctx,
+                   NotificationDispatch mode = NotificationDispatch::Deferred);
+    bool subscribe(NotificationKey key, NotificationHandler handler, void* ctx,
+                   NotificationDispatch mode = NotificationDispatch::Deferred);
+    
+    /**
+     * @brief Stop calling a key's handler, later items stay pending for consume()
+     * 
+     * @return true if the key had a handler
+     * @note A handler call already in progress still completes, see waitHandlerIdle()
+     */
+    bool unsubscribe(const char* key);
+    bool unsubscribe(NotificationKey key);
+    
+    /**
+     * @brief Wait until no call of a key's handler is in progress
+     * 
+     * After unsubscribe() no new call starts, so once this returns whatever the
+     * handler's ctx points to can be freed.
+     * 
+     * @note Don't call it from the handler itself, it would wait for its own call
+     */
+    void waitHandlerIdle(NotificationKey key);
+    
+    /**
+     * @brief Pin a key to the core its consumers and deferred handler run on
+     * 
+     * A send() through a NotificationKey from the other core then skips the
+     * shard mutex: the item goes into the shard's lock-free ring, only the first
+     * item since the last drain wakes the key's waiters, and the consumer stores
+     * the whole batch when it next takes the lock on its own core. Same-core
+     * sends take the lock as before, so the mutex never changes hands across
+     * cores. Keys that block, drop new items or coalesce, and sends that find
+     * the ring full, use the locked path.
+     * 
+     * With NOTIFICATION_DISPATCH_PER_CORE the handler also runs on this core,
+     * where it otherwise runs on the core that sent the item.
+     * 
+     * @param key The notification key
+     * @param core Core id, or tskNO_AFFINITY to follow the sender again
+     * @return true if set, false for an invalid core
+     * @note Set it at startup, senders read it without the lock
+     */
+    bool setAffinity(const char* key, BaseType_t core);
+    bool setAffinity(NotificationKey key, BaseType_t core);
+    
+    /**
+     * @brief Register a key pattern and get a handle for it
+     * 
+     * Matching is done once per key, when the key is first used or when the
+     * pattern is registered, so a send to a matching key costs nothing extra.
+     * New keys are matched by walking a segment trie in O(key length).
+     * 
+     * @param pattern Segments separated by '/', '+' for one segment, trailing '#' for the rest
+     * @return Handle for the pattern calls, invalid if malformed or the pattern tables are full
+     * @note Registering the same pattern again returns the same handle
+     */
+    NotificationPattern registerPattern(const char* pattern);
+    
+    /**
+     * @brief Call a handler for items on every key matching a pattern
+     * 
+     * Keys with their own subscribe() handler keep it. Signal and broadcast keys are skipped.
+     */
+    bool subscribe(NotificationPattern pattern, NotificationHandler handler, void* ctx,
+                   NotificationDispatch mode = NotificationDispatch::Deferred);
+    
+    /**
+     * @brief Consume an item from whichever key matching a pattern has one
+     * 
+     * @param pattern Handle from registerPattern(), or the pattern string
+     * @param matched Receives the key the item came from, may be nullptr
+     * @param timeout_ticks Timeout in ticks to wait for a matching item
+     * @return void* pointer to data, or nullptr on timeout
+     * @note Takes every shard lock. Signal and broadcast keys are skipped, and so are
+     *       keys whose next item isn't a pointer, which stays pending
+     */
+    void* consumePattern(NotificationPattern pattern, NotificationKey* matched = nullptr,
+                         TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    void* consumePattern(const char* pattern, NotificationKey* matched = nullptr,
+                         TickType_t timeout_ticks = pdMS_TO_TICKS(100));
+    
+    /**
+     * @brief Wait until any key matching a pattern has an item, without consuming it
+     * 
+     * @return true if a matching key has an item (stored in matched), false on timeout
+     */
+    bool waitPattern(NotificationPattern pattern, NotificationKey* matched = nullptr,
+                     TickType_t timeout_ticks = portMAX_DELAY);
+    bool waitPattern(const char* pattern, NotificationKey* matched = nullptr,
+                     TickType_t timeout_ticks = portMAX_DELAY);
 };
@@ -0,0 +1,459 @@
+#include "NotificationBridge.h"
+#include <string.h>
+#include "esp_random.h"
+
+// Frame: magic, version, node (2), epoch (2), seq (2), length (2), records..., CRC-16 (2)
+// Record: wire id (4), type, size, payload
+// Multi-byte fields are little-endian
+static const uint8_t FRAME_MAGIC = 0xB5;
+static const uint8_t FRAME_VERSION = 2;
+static const size_t FRAME_HEADER = 10;
+static const size_t FRAME_CRC = 2;
+static const size_t RECORD_HEADER = 6;
+
+static_assert(NOTIFICATION_BRIDGE_FRAME_SIZE >= FRAME_HEADER + FRAME_CRC + RECORD_HEADER + NOTIFICATION_INLINE_PAYLOAD_SIZE,
+              "NOTIFICATION_BRIDGE_FRAME_SIZE can't hold a single record");
+static_assert(NOTIFICATION_BRIDGE_FRAME_SIZE <= UINT16_MAX,
+              "NOTIFICATION_BRIDGE_FRAME_SIZE must fit the 16-bit length field");
+
+static const TickType_t FLUSH_TICKS =
+    pdMS_TO_TICKS(NOTIFICATION_BRIDGE_FLUSH_MS) > 0 ? pdMS_TO_TICKS(NOTIFICATION_BRIDGE_FLUSH_MS) : 1;
+
+static void put16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void put32(uint8_t* out, uint32_t value) {
+    put16(out, (uint16_t)value);
+    put16(out + 2, (uint16_t)(value >> 16));
+}
+
+static uint16_t get16(const uint8_t* in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static uint32_t get32(const uint8_t* in) {
+    return get16(in) | ((uint32_t)get16(in + 2) << 16);
+}
+
+const char* NotificationBridge::TAG = "NotificationBridge";
+
+NotificationBridge::NotificationBridge(Notification& notification, uint16_t node,
+                                       NotificationTransport transport, void* ctx)
+    : notification(notification), node(node), transport(transport), transportCtx(ctx),
+      epoch((uint16_t)esp_random()) {
+#if NOTIFICATION_STATIC_ALLOCATION
+    lock = xSemaphoreCreateMutexStatic(&lockBuffer);
+    flushTimer = xTimerCreateStatic("notify_bridge", FLUSH_TICKS, pdFALSE, this, flushTimerCallback,
+                                    &flushTimerBuffer);
+#else
+    lock = xSemaphoreCreateMutex();
+    flushTimer = xTimerCreate("notify_bridge", FLUSH_TICKS, pdFALSE, this, flushTimerCallback);
+#endif
+    if (lock == nullptr || flushTimer == nullptr) {
+        ESP_LOGE(TAG, "Failed to create bridge lock or flush timer");
+    }
+}
+
+NotificationBridge::~NotificationBridge() {
+    // No new onItem() starts after unsubscribe(), then wait out the ones already running
+    for (size_t i = 0; i < routeCount; i++) {
+        if (routes[i].outbound) {
+            notification.unsubscribe(routes[i].key);
+        }
+    }
+    for (size_t i = 0; i < routeCount; i++) {
+        if (routes[i].outbound) {
+            notification.waitHandlerIdle(routes[i].key);
+        }
+    }
+    if (flushTimer != nullptr) {
+        // The timer task runs commands and callbacks in order, so once the pended
+        // call has run the timer is gone and no flush() is in flight
+        xTimerDelete(flushTimer, portMAX_DELAY);
+        if (xTimerPendFunctionCall(flushTimerDrained, this, 0, portMAX_DELAY) == pdPASS) {
+            while (!flushTimerStopped.load()) {
+                vTaskDelay(1);
+            }
+        }
+    }
+    if (lock != nullptr) {
+        vSemaphoreDelete(lock);
+    }
+}
+
+bool NotificationBridge::forward(const char* key, bool coalesce) {
+    if (!addRoute(key, true, coalesce)) {
+        return false;
+    }
+    
+    uint32_t id = notificationHash(key);
+    Route route;
+    if (routeOf(id, route) && notification.subscribe(route.key, onItem, this)) {
+        return true;
+    }
+    
+    ESP_LOGE(TAG, "Failed to subscribe forwarded key: %s", key);
+    portENTER_CRITICAL(&routeLock);
+    for (size_t i = 0; i < routeCount; i++) {
+        if (routes[i].wireId == id) {
+            routes[i] = routes[--routeCount];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&routeLock);
+    return false;
+}
+
+bool NotificationBridge::accept(const char* key) {
+    return addRoute(key, false, false);
+}
+
+bool NotificationBridge::addRoute(const char* key, bool outbound, bool coalesce) {
+    if (lock == nullptr || flushTimer == nullptr) {
+        return false;
+    }
+    NotificationKey handle = notification.registerKey(key);
+    if (!handle.valid()) {
+        return false;
+    }
+    
+    // Peers only see the wire id, so two names with the same hash can't both be routed
+    uint32_t id = notificationHash(key);
+    Route existing;
+    portENTER_CRITICAL(&routeLock);
+    bool full = routeCount >= NOTIFICATION_BRIDGE_MAX_KEYS;
+    bool collides = !full && findRoute(id, existing);
+    if (!full && !collides) {
+        Route& route = routes[routeCount];
+        route.wireId = id;
+        route.key = handle;
+        route.outbound = outbound;
+        route.coalesce = coalesce;
+        routeCount++;
+    }
+    portEXIT_CRITICAL(&routeLock);
+    
+    if (full) {
+        ESP_LOGE(TAG, "Route table full, can't add key: %s", key);
+        return false;
+    }
+    if (collides) {
+        ESP_LOGE(TAG, "Key already routed or wire id collides: %s", key);
+        return false;
+    }
+    
+    ESP_LOGD(TAG, "%s key: %s, wire id: %08lx", outbound ? "Forwarding" : "Accepting", key, (unsigned long)id);
+    return true;
+}
+
+bool NotificationBridge::routeOf(NotificationKey key, Route& route) {
+    portENTER_CRITICAL(&routeLock);
+    bool found = false;
+    for (size_t i = 0; i < routeCount && !found; i++) {
+        if (routes[i].key.index == key.index) {
+            route = routes[i];
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&routeLock);
+    return found;
+}
+
+bool NotificationBridge::routeOf(uint32_t wire_id, Route& route) {
+    portENTER_CRITICAL(&routeLock);
+    bool found = findRoute(wire_id, route);
+    portEXIT_CRITICAL(&routeLock);
+    return found;
+}
+
+bool NotificationBridge::findRoute(uint32_t wire_id, Route& route) const {
+    for (size_t i = 0; i < routeCount; i++) {
+        if (routes[i].wireId == wire_id) {
+            route = routes[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void NotificationBridge::onItem(const NotificationEvent& event, void* ctx) {
+    NotificationBridge* self = static_cast<NotificationBridge*>(ctx);
+    Route route;
+    bool routed = self->routeOf(event.key, route);
+    
+    if (event.type == NotificationPayload::Signal && routed) {
+        uint8_t payload[4];
+        put32(payload, (uint32_t)event.signal);
+        self->append(route, event.type, payload, sizeof(payload));
+    } else if (event.type == NotificationPayload::Value && routed) {
+        self->append(route, event.type, event.value, event.valueSize);
+    } else if (event.type == NotificationPayload::Data || event.type == NotificationPayload::Request) {
+        // A pointer means nothing on another device
+        ESP_LOGW(TAG, "Can't forward pointer payload, dropped");
+        self->notification.release(event.data);
+        self->received.unsupported.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void NotificationBridge::append(const Route& route, NotificationPayload type, const void* payload, size_t size) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    
+    if (route.coalesce) {
+        size_t offset = FRAME_HEADER;
+        while (frameLength > 0 && offset < frameLength) {
+            uint8_t* record = frame + offset;
+            if (get32(record) == route.wireId && record[4] == (uint8_t)type && record[5] == size) {
+                memcpy(record + RECORD_HEADER, payload, size);
+                stats.coalesced++;
+                xSemaphoreGive(lock);
+                return;
+            }
+            offset += RECORD_HEADER + record[5];
+        }
+    }
+    
+    // Size-based flush: the record goes into the next frame if it doesn't fit this one
+    if (frameLength > 0 && frameLength + RECORD_HEADER + size + FRAME_CRC > NOTIFICATION_BRIDGE_FRAME_SIZE) {
+        flushHeld();
+    }
+    
+    // Time-based flush: the first record of a frame starts the timer
+    if (frameLength == 0) {
+        frameLength = FRAME_HEADER;
+        xTimerStart(flushTimer, 0);
+    }
+    
+    uint8_t* record = frame + frameLength;
+    put32(record, route.wireId);
+    record[4] = (uint8_t)type;
+    record[5] = (uint8_t)size;
+    memcpy(record + RECORD_HEADER, payload, size);
+    frameLength += RECORD_HEADER + size;
+    stats.recordsSent++;
+    
+    xSemaphoreGive(lock);
+}
+
+bool NotificationBridge::flush() {
+    if (lock == nullptr) {
+        return false;
+    }
+    
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool sent = flushHeld();
+    xSemaphoreGive(lock);
+    return sent;
+}
+
+bool NotificationBridge::flushHeld() {
+    if (frameLength == 0) {
+        return true;
+    }
+    
+    size_t length = frameLength + FRAME_CRC;
+    frame[0] = FRAME_MAGIC;
+    frame[1] = FRAME_VERSION;
+    put16(frame + 2, node);
+    put16(frame + 4, epoch);
+    put16(frame + 6, seq++);
+    put16(frame + 8, (uint16_t)length);
+    put16(frame + frameLength, crc16(frame, frameLength));
+    frameLength = 0;
+    
+    if (!transport(frame, length, transportCtx)) {
+        ESP_LOGW(TAG, "Transport dropped frame of %zu bytes", length);
+        stats.transportErrors++;
+        return false;
+    }
+    
+    stats.framesSent++;
+    return true;
+}
+
+void NotificationBridge::flushTimerCallback(TimerHandle_t timer) {
+    static_cast<NotificationBridge*>(pvTimerGetTimerID(timer))->flush();
+}
+
+void NotificationBridge::flushTimerDrained(void* self, uint32_t) {
+    static_cast<NotificationBridge*>(self)->flushTimerStopped.store(true);
+}
+
+bool NotificationBridge::receive(const uint8_t* data, size_t length) {
+    if (!intact(data, length)) {
+        received.corrupt.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    // Broadcast links echo our own frames back
+    uint16_t sender = get16(data + 2);
+    if (sender == node) {
+        return false;
+    }
+    
+    if (!accepted(sender, get16(data + 4), get16(data + 6))) {
+        received.duplicates.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    
+    received.framesReceived.fetch_add(1, std::memory_order_relaxed);
+    deliver(data + FRAME_HEADER, length - FRAME_HEADER - FRAME_CRC);
+    return true;
+}
+
+size_t NotificationBridge::receiveBytes(const uint8_t* bytes, size_t length) {
+    size_t frames = 0;
+    
+    for (size_t i = 0; i < length; i++) {
+        if (rxLength == 0 && bytes[i] != FRAME_MAGIC) {
+            continue;
+        }
+        rx[rxLength++] = bytes[i];
+        
+        while (rxLength >= FRAME_HEADER) {
+            size_t declared = get16(rx + 8);
+            bool framed = rx[1] == FRAME_VERSION && declared >= FRAME_HEADER + FRAME_CRC &&
+                          declared <= NOTIFICATION_BRIDGE_FRAME_SIZE;
+            if (framed && rxLength < declared) {
+                break;
+            }
+            
+            if (framed && intact(rx, declared)) {
+                frames += receive(rx, declared) ? 1 : 0;
+                rxLength = 0;
+                break;
+            }
+            
+            // Not a frame after all, restart at the next magic byte
+            if (framed) {
+                received.corrupt.fetch_add(1, std::memory_order_relaxed);
+            }
+            const uint8_t* next = (const uint8_t*)memchr(rx + 1, FRAME_MAGIC, rxLength - 1);
+            size_t skip = next != nullptr ? (size_t)(next - rx) : rxLength;
+            memmove(rx, rx + skip, rxLength - skip);
+            rxLength -= skip;
+        }
+    }
+    
+    return frames;
+}
+
+bool NotificationBridge::intact(const uint8_t* data, size_t length) {
+    return length >= FRAME_HEADER + FRAME_CRC && length <= NOTIFICATION_BRIDGE_FRAME_SIZE &&
+           data[0] == FRAME_MAGIC && data[1] == FRAME_VERSION && get16(data + 8) == length &&
+           get16(data + length - FRAME_CRC) == crc16(data, length - FRAME_CRC);
+}
+
+bool NotificationBridge::accepted(uint16_t sender, uint16_t frame_epoch, uint16_t frame_seq) {
+    Peer* peer = nullptr;
+    for (size_t i = 0; i < NOTIFICATION_BRIDGE_MAX_PEERS && peer == nullptr; i++) {
+        if (peers[i].used && peers[i].node == sender) {
+            peer = &peers[i];
+        }
+    }
+    
+    if (peer == nullptr) {
+        for (size_t i = 0; i < NOTIFICATION_BRIDGE_MAX_PEERS && peer == nullptr; i++) {
+            if (!peers[i].used) {
+                peer = &peers[i];
+            }
+        }
+        if (peer == nullptr) {
+            peer = &peers[nextPeer];
+            nextPeer = (nextPeer + 1) % NOTIFICATION_BRIDGE_MAX_PEERS;
+        }
+        peer->used = true;
+        peer->node = sender;
+        peer->epoch = frame_epoch;
+        peer->seq = frame_seq;
+        peer->window = 1;
+        return true;
+    }
+    
+    // A new epoch means the sender restarted and its sequence began again
+    if (frame_epoch != peer->epoch) {
+        peer->epoch = frame_epoch;
+        peer->seq = frame_seq;
+        peer->window = 1;
+        return true;
+    }
+    
+    int16_t delta = (int16_t)(frame_seq - peer->seq);
+    if (delta > 0) {
+        peer->window = delta >= 32 ? 1 : (peer->window << delta) | 1;
+        peer->seq = frame_seq;
+        return true;
+    }
+    
+    // Too old to tell from a duplicate, drop it
+    if (-delta >= 32) {
+        return false;
+    }
+    
+    uint32_t bit = 1u << -delta;
+    if (peer->window & bit) {
+        return false;
+    }
+    peer->window |= bit;
+    return true;
+}
+
+void NotificationBridge::deliver(const uint8_t* records, size_t length) {
+    size_t offset = 0;
+    
+    while (offset + RECORD_HEADER <= length) {
+        const uint8_t* record = records + offset;
+        size_t size = record[5];
+        if (offset + RECORD_HEADER + size > length) {
+            ESP_LOGW(TAG, "Truncated record in frame");
+            received.corrupt.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        offset += RECORD_HEADER + size;
+        
+        // Keys nobody accepted here, and our own forwarded keys, are ignored
+        Route route;
+        if (!routeOf(get32(record), route) || route.outbound) {
+            continue;
+        }
+        
+        const uint8_t* payload = record + RECORD_HEADER;
+        bool sent = false;
+        if (record[4] == (uint8_t)NotificationPayload::Signal && size == 4) {
+            sent = notification.send(route.key, (int)get32(payload));
+        } else if (record[4] == (uint8_t)NotificationPayload::Value) {
+            sent = notification.sendValue(route.key, payload, size);
+        }
+        if (sent) {
+            received.recordsReceived.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void NotificationBridge::getStats(NotificationBridgeStats& stats) {
+    if (lock != nullptr) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+    }
+    stats = this->stats;
+    if (lock != nullptr) {
+        xSemaphoreGive(lock);
+    }
+    stats.framesReceived = received.framesReceived.load(std::memory_order_relaxed);
+    stats.recordsReceived = received.recordsReceived.load(std::memory_order_relaxed);
+    stats.duplicates = received.duplicates.load(std::memory_order_relaxed);
+    stats.corrupt = received.corrupt.load(std::memory_order_relaxed);
+    stats.unsupported = received.unsupported.load(std::memory_order_relaxed);
+}
+
+uint16_t NotificationBridge::crc16(const uint8_t* data, size_t length) {
+    // CRC-16/CCITT-FALSE
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "Notification.h"
+
+/**
+ * @brief Sends one encoded frame to the peers
+ * 
+ * Wrap esp_now_send() or uart_write_bytes() here. Called from the dispatcher
+ * task or the timer task, so keep it short.
+ * 
+ * @return true if the frame was handed to the link
+ */
+typedef bool (*NotificationTransport)(const uint8_t* frame, size_t length, void* ctx);
+
+/**
+ * @brief Bridge counters, see NotificationBridge::getStats()
+ */
+struct NotificationBridgeStats {
+    uint32_t framesSent;
+    uint32_t framesReceived;
+    uint32_t recordsSent;
+    uint32_t recordsReceived;
+    uint32_t coalesced;         // Records overwritten by a newer update before the frame went out
+    uint32_t duplicates;        // Frames dropped by the receive window
+    uint32_t corrupt;           // Frames with a bad header, length or CRC
+    uint32_t unsupported;       // Pointer payloads, which can't leave the device
+    uint32_t transportErrors;
+};
+
+/**
+ * @brief Mirrors selected keys to other devices over any frame transport
+ * 
+ * Items sent to a forwarded key are consumed by the bridge and packed into
+ * binary frames: a header with the sender's node id, a random per-boot epoch
+ * and a frame sequence number, then one record per item with the key's wire id, its type and its
+ * inline payload. A frame goes out when the next record would not fit or
+ * NOTIFICATION_BRIDGE_FLUSH_MS after its first record. On the receiving device
+ * frames are checked, deduplicated per sender and re-sent into the local
+ * instance under the same key.
+ * 
+ * Keys travel as a 32-bit FNV-1a hash of their name, so both sides only have to
+ * agree on the names. Signals and sendValue() payloads cross; void* payloads are
+ * released and counted as unsupported.
+ * 
+ * @code
+ * static bool espNowSend(const uint8_t* frame, size_t length, void* ctx) {
+ *     return esp_now_send(broadcastMac, frame, length) == ESP_OK;
+ * }
+ * 
+ * NotificationBridge bridge(*notification, 1, espNowSend, nullptr);
+ * bridge.forward("temperature");      // Local sends go to the peers
+ * bridge.accept("setpoint");          // Peer sends arrive here
+ * 
+ * // In the ESP-NOW receive callback
+ * bridge.receive(data, length);
+ * @endcode
+ */
+class NotificationBridge {
+private:
+    struct Route {
+        uint32_t wireId;
+        NotificationKey key;
+        bool outbound;              // forward() rather than accept()
+        bool coalesce;              // A newer update replaces one still waiting in the frame
+    };
+    
+    struct Peer {
+        uint16_t node;
+        uint16_t epoch;             // Sender's boot epoch the window belongs to
+        uint16_t seq;               // Highest frame sequence seen
+        uint32_t window;            // Bit n set when frame seq - n was seen
+        bool used;
+    };
+    
+    Notification& notification;
+    uint16_t node;
+    NotificationTransport transport;
+    void* transportCtx;
+    
+    // Written by forward()/accept(), read by the handler and the receive path
+    Route routes[NOTIFICATION_BRIDGE_MAX_KEYS] = {};
+    size_t routeCount = 0;
+    portMUX_TYPE routeLock = portMUX_INITIALIZER_UNLOCKED;
+    Peer peers[NOTIFICATION_BRIDGE_MAX_PEERS] = {};
+    size_t nextPeer = 0;            // Replaced next when the peer table is full
+    
+    // Outgoing frame, built in place, guarded by lock
+    SemaphoreHandle_t lock = nullptr;
+    TimerHandle_t flushTimer = nullptr;
+    std::atomic<bool> flushTimerStopped{false};     // Set by the timer task once it is done with flushTimer
+    uint8_t frame[NOTIFICATION_BRIDGE_FRAME_SIZE];
+    size_t frameLength = 0;
+    uint16_t epoch;                 // Random per boot, tells peers the sequence restarted
+    uint16_t seq = 0;
+#if NOTIFICATION_STATIC_ALLOCATION
+    StaticSemaphore_t lockBuffer;
+    StaticTimer_t flushTimerBuffer;
+#endif
+    
+    // Byte stream reassembly for receiveBytes()
+    uint8_t rx[NOTIFICATION_BRIDGE_FRAME_SIZE];
+    size_t rxLength = 0;
+    
+    NotificationBridgeStats stats = {};         // Send side, guarded by lock
+    
+    // Bumped by the receive path and the handler without lock, which a receive
+    // callback shouldn't wait for while a flush is in the transport
+    struct Counters {
+        std::atomic<uint32_t> framesReceived{0};
+        std::atomic<uint32_t> recordsReceived{0};
+        std::atomic<uint32_t> duplicates{0};
+        std::atomic<uint32_t> corrupt{0};
+        std::atomic<uint32_t> unsupported{0};
+    };
+    Counters received;
+    
+    static const char* TAG;
+    
+    static uint16_t crc16(const uint8_t* data, size_t length);
+    static bool intact(const uint8_t* data, size_t length);
+    
+    bool addRoute(const char* key, bool outbound, bool coalesce);
+    // Copy a route out under routeLock, findRoute() expects it held
+    bool routeOf(NotificationKey key, Route& route);
+    bool routeOf(uint32_t wire_id, Route& route);
+    bool findRoute(uint32_t wire_id, Route& route) const;
+    
+    void append(const Route& route, NotificationPayload type, const void* payload, size_t size);
+    bool flushHeld();
+    bool accepted(uint16_t sender, uint16_t frame_epoch, uint16_t frame_seq);
+    void deliver(const uint8_t* records, size_t length);
+    
+    static void onItem(const NotificationEvent& event, void* ctx);
+    static void flushTimerCallback(TimerHandle_t timer);
+    static void flushTimerDrained(void* self, uint32_t unused);
+    
+public:
+    /**
+     * @brief Constructor
+     * 
+     * @param notification Local instance, must outlive the bridge
+     * @param node This device's id, unique among the peers
+     * @param transport Sends encoded frames
+     * @param ctx Passed through to transport
+     */
+    NotificationBridge(Notification& notification, uint16_t node,
+                       NotificationTransport transport, void* ctx);
+    
+    /**
+     * @brief Destructor - unsubscribes the forwarded keys and drops the unsent frame
+     * 
+     * Waits for handler calls and a flush already in progress, so it may block briefly.
+     */
+    ~NotificationBridge();
+    
+    /**
+     * @brief Send every item for a local key to the peers
+     * 
+     * The bridge subscribes to the key, so local consumers no longer see it.
+     * 
+     * @param key The notification key
+     * @param coalesce Let a newer update replace one still waiting in the frame.
+     *        Turn off for keys where every item matters
+     * @return true if forwarded, false if the key is already routed, its wire id
+     *         collides, the route table is full or subscribe() fails
+     */
+    bool forward(const char* key, bool coalesce = true);
+    
+    /**
+     * @brief Deliver items for a key received from peers to the local instance
+     * 
+     * @return true if accepted, false if the key is already routed, its wire id
+     *         collides or the route table is full
+     */
+    bool accept(const char* key);
+    
+    /**
+     * @brief Send the partial frame now
+     * 
+     * @return true if there was nothing to send or the transport took it
+     */
+    bool flush();
+    
+    /**
+     * @brief Handle one frame from a datagram transport like ESP-NOW
+     * 
+     * @return true if the frame was valid and new
+     * @note Call from one task at a time
+     */
+    bool receive(const uint8_t* data, size_t length);
+    
+    /**
+     * @brief Handle bytes from a stream transport like UART
+     * 
+     * Frames may arrive split across calls. Garbage between frames is skipped
+     * by searching for the next header with a valid CRC.
+     * 
+     * @return Number of valid new frames completed by these bytes
+     * @note Call from one task at a time
+     */
+    size_t receiveBytes(const uint8_t* bytes, size_t length);
+    
+    /**
+     * @brief Copy the bridge counters
+     */
+    void getStats(NotificationBridgeStats& stats);
+};
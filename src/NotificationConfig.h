@@ -0,0 +1,321 @@
+#pragma once
+
+/**
+ * @file NotificationConfig.h
+ * @brief Compile-time configuration for the Notification system
+ *
+ * Every value can be overridden with a build flag (e.g. -DNOTIFICATION_MAX_WAITERS=32)
+ * before this header is included.
+ */
+
+/**
+ * @brief Maximum number of tasks that can block in consume()/signal()/wait() at once
+ *
+ * A waiting task parks on its own task notification and is woken by send().
+ * When the registry is full, extra waiters fall back to a 1 tick poll.
+ */
+#ifndef NOTIFICATION_MAX_WAITERS
+#define NOTIFICATION_MAX_WAITERS 16
+#endif
+
+/**
+ * @brief Task notification index used to park waiting tasks
+ *
+ * Index 0 is the one plain xTaskNotifyGive()/ulTaskNotifyTake() use, so sharing it
+ * means spurious wake-ups for your tasks and gives swallowed by this library.
+ * The default is therefore 1, which needs CONFIG_FREERTOS_TASK_NOTIFICATION_ARRAY_ENTRIES
+ * of at least 2 in sdkconfig. ESP-IDF ships 1, in which case only index 0 exists
+ * and it is shared; don't wait on task notifications in tasks that use this library then.
+ * Must be lower than configTASK_NOTIFICATION_ARRAY_ENTRIES, which the build checks.
+ */
+#ifndef NOTIFICATION_NOTIFY_INDEX
+#define NOTIFICATION_NOTIFY_INDEX (configTASK_NOTIFICATION_ARRAY_ENTRIES > 1 ? 1 : 0)
+#endif
+
+/**
+ * @brief Number of distinct keys the key table can hold (power of two)
+ *
+ * Keys are interned on first use and keep their slot for the lifetime of the
+ * instance, so this bounds the number of different key names, not pending items.
+ */
+#ifndef NOTIFICATION_MAX_KEYS
+#define NOTIFICATION_MAX_KEYS 64
+#endif
+
+/**
+ * @brief Number of independently locked key table shards (power of two, max 32)
+ *
+ * Keys are spread over shards by hash and each shard has its own mutex, so tasks
+ * on different cores touching unrelated keys don't contend. Each shard holds
+ * NOTIFICATION_MAX_KEYS / NOTIFICATION_SHARDS keys.
+ */
+#ifndef NOTIFICATION_SHARDS
+#define NOTIFICATION_SHARDS 4
+#endif
+
+/**
+ * @brief Maximum key length in bytes, including the terminating NUL
+ *
+ * Keys are copied inline into their slot. Longer keys are rejected.
+ */
+#ifndef NOTIFICATION_KEY_MAX_LEN
+#define NOTIFICATION_KEY_MAX_LEN 32
+#endif
+
+/**
+ * @brief Entries in each shard's lock-free ring used by sendFromISR() (power of two)
+ *
+ * ISR sends wait here until the next task-side call on the shard drains them into the key table.
+ */
+#ifndef NOTIFICATION_ISR_QUEUE_LEN
+#define NOTIFICATION_ISR_QUEUE_LEN 16
+#endif
+
+/**
+ * @brief Buckets in each shard's TTL expiry wheel (power of two)
+ *
+ * Keys with expiring items are hashed into a bucket by expiry tick, so the
+ * reaper only visits keys due in the buckets that elapsed since its last run.
+ */
+#ifndef NOTIFICATION_TTL_WHEEL_SIZE
+#define NOTIFICATION_TTL_WHEEL_SIZE 32
+#endif
+
+/**
+ * @brief Period of the TTL reaper timer in milliseconds
+ *
+ * Also the width of one wheel bucket. Expired items are never delivered, this
+ * only bounds how long they keep their queue space.
+ */
+#ifndef NOTIFICATION_TTL_RESOLUTION_MS
+#define NOTIFICATION_TTL_RESOLUTION_MS 100
+#endif
+
+/**
+ * @brief Key patterns that can be registered with registerPattern() (max 32)
+ */
+#ifndef NOTIFICATION_MAX_PATTERNS
+#define NOTIFICATION_MAX_PATTERNS 8
+#endif
+
+/**
+ * @brief Nodes in the pattern trie, one per distinct pattern segment (max 255)
+ */
+#ifndef NOTIFICATION_MAX_PATTERN_NODES
+#define NOTIFICATION_MAX_PATTERN_NODES 32
+#endif
+
+/**
+ * @brief Dispatcher tasks shared by all deferred subscribe() handlers
+ */
+#ifndef NOTIFICATION_DISPATCH_TASKS
+#define NOTIFICATION_DISPATCH_TASKS 1
+#endif
+
+/**
+ * @brief Give every core its own dispatch queue and pinned dispatcher tasks
+ *
+ * When 1, NOTIFICATION_DISPATCH_TASKS tasks are pinned to each core and each core
+ * has its own queue. A deferred handler runs on the core set with setAffinity(),
+ * or else on the core that sent the item, so a core-pinned pipeline never hands
+ * its handler work to the other core. Sends to a pinned key from the other core
+ * skip the shard mutex with or without this, see setAffinity().
+ */
+#ifndef NOTIFICATION_DISPATCH_PER_CORE
+#define NOTIFICATION_DISPATCH_PER_CORE 0
+#endif
+
+/**
+ * @brief Stack size in bytes of each dispatcher task
+ *
+ * Handlers run on this stack, size it for the deepest one.
+ */
+#ifndef NOTIFICATION_DISPATCH_STACK
+#define NOTIFICATION_DISPATCH_STACK 4096
+#endif
+
+/**
+ * @brief FreeRTOS priority of the dispatcher tasks
+ */
+#ifndef NOTIFICATION_DISPATCH_PRIORITY
+#define NOTIFICATION_DISPATCH_PRIORITY 5
+#endif
+
+/**
+ * @brief Entries in the dispatch queue, one per key with items for its handler
+ *
+ * When it is full the item stays pending and is handed over on the key's next send.
+ */
+#ifndef NOTIFICATION_DISPATCH_QUEUE_LEN
+#define NOTIFICATION_DISPATCH_QUEUE_LEN 16
+#endif
+
+/**
+ * @brief Create every kernel object from storage inside the instance
+ *
+ * When 1, shard mutexes, the TTL reaper, the dispatch queue and the dispatcher
+ * tasks use the xCreateStatic() APIs, and setQueueMode() takes its rings from a
+ * fixed arena, so nothing touches the heap after construction and the footprint
+ * is sizeof(Notification). Also enabled by CONFIG_NOTIFICATION_STATIC_ALLOCATION.
+ */
+#ifndef NOTIFICATION_STATIC_ALLOCATION
+#ifdef CONFIG_NOTIFICATION_STATIC_ALLOCATION
+#define NOTIFICATION_STATIC_ALLOCATION 1
+#else
+#define NOTIFICATION_STATIC_ALLOCATION 0
+#endif
+#endif
+
+/**
+ * @brief Queue items in the static arena shared by all queue and broadcast keys
+ *
+ * Only used with NOTIFICATION_STATIC_ALLOCATION. Storage handed to a key is kept
+ * for the lifetime of the instance and reused if the key's mode is set again
+ * with the same or a smaller depth.
+ */
+#ifndef NOTIFICATION_STATIC_QUEUE_ITEMS
+#define NOTIFICATION_STATIC_QUEUE_ITEMS 64
+#endif
+
+/**
+ * @brief Smallest heap allocation in bytes that is placed in PSRAM, 0 to keep everything internal
+ *
+ * Applies to queue and broadcast rings and to NotificationPool slabs created
+ * without explicit caps. Key table, waiter records and the instance itself stay
+ * in internal RAM. PSRAM can't be touched while the flash cache is disabled, so
+ * don't fill PSRAM pool blocks from IRAM ISRs.
+ */
+#ifndef NOTIFICATION_PSRAM_THRESHOLD
+#define NOTIFICATION_PSRAM_THRESHOLD 0
+#endif
+
+/**
+ * @brief Largest NotificationBridge frame in bytes, header and CRC included
+ *
+ * The default matches ESP_NOW_MAX_DATA_LEN. Records are batched until the next
+ * one would not fit.
+ */
+#ifndef NOTIFICATION_BRIDGE_FRAME_SIZE
+#define NOTIFICATION_BRIDGE_FRAME_SIZE 250
+#endif
+
+/**
+ * @brief Longest time in milliseconds a NotificationBridge holds a partial frame
+ */
+#ifndef NOTIFICATION_BRIDGE_FLUSH_MS
+#define NOTIFICATION_BRIDGE_FLUSH_MS 20
+#endif
+
+/**
+ * @brief Keys one NotificationBridge can forward plus accept
+ */
+#ifndef NOTIFICATION_BRIDGE_MAX_KEYS
+#define NOTIFICATION_BRIDGE_MAX_KEYS 16
+#endif
+
+/**
+ * @brief Remote nodes a NotificationBridge tracks for duplicate suppression
+ */
+#ifndef NOTIFICATION_BRIDGE_MAX_PEERS
+#define NOTIFICATION_BRIDGE_MAX_PEERS 8
+#endif
+
+/**
+ * @brief Keys whose last value survives a reset, see setPersistent() (max 255)
+ *
+ * 0 compiles persistence out.
+ */
+#ifndef NOTIFICATION_PERSIST_KEYS
+#define NOTIFICATION_PERSIST_KEYS 0
+#endif
+
+#define NOTIFICATION_PERSIST_RTC 1  // RTC slow memory: kept across deep sleep and software resets
+#define NOTIFICATION_PERSIST_NVS 2  // NVS flash: kept across power loss, written by persist()
+
+/**
+ * @brief Where the persistent key snapshot is kept
+ *
+ * The RTC snapshot is updated on every send. The NVS snapshot is only written by
+ * persist(), one blob per changed key, so flash wear is under the caller's control.
+ */
+#ifndef NOTIFICATION_PERSIST_STORE
+#define NOTIFICATION_PERSIST_STORE NOTIFICATION_PERSIST_RTC
+#endif
+
+/**
+ * @brief Requests that can wait for a reply at once, across all tasks (max 256)
+ */
+#ifndef NOTIFICATION_MAX_REQUESTS
+#define NOTIFICATION_MAX_REQUESTS 8
+#endif
+
+/**
+ * @brief Payload pools that can be attached to one Notification instance
+ */
+#ifndef NOTIFICATION_MAX_POOLS
+#define NOTIFICATION_MAX_POOLS 4
+#endif
+
+/**
+ * @brief Bytes of inline payload each item can carry by value (max 255)
+ *
+ * Used by sendValue()/consumeValue() and TypedChannel<T>. Every slot and queue
+ * entry reserves this much, so keep it small.
+ */
+#ifndef NOTIFICATION_INLINE_PAYLOAD_SIZE
+#define NOTIFICATION_INLINE_PAYLOAD_SIZE 16
+#endif
+
+/**
+ * @brief Default time a call waits for a contended shard lock, in milliseconds
+ *
+ * Per instance with Notification::setLockTimeout(). The try*() calls never wait.
+ */
+#ifndef NOTIFICATION_LOCK_TIMEOUT_MS
+#define NOTIFICATION_LOCK_TIMEOUT_MS 100
+#endif
+
+/**
+ * @brief Collect per-key and global counters for getStats()
+ *
+ * Off by default; when 0 the counters and the item send timestamps are compiled out.
+ */
+#ifndef NOTIFICATION_ENABLE_STATS
+#define NOTIFICATION_ENABLE_STATS 0
+#endif
+
+/**
+ * @brief Buckets in the send-to-consume latency histogram
+ *
+ * Bucket i counts latencies below 16 << (2 * i) us; the last bucket takes the rest.
+ */
+#ifndef NOTIFICATION_STATS_BUCKETS
+#define NOTIFICATION_STATS_BUCKETS 8
+#endif
+
+/**
+ * @brief Record sends, consumes, waits and lock takes in a trace ring for getTrace()
+ *
+ * Off by default; when 0 every trace point compiles to nothing.
+ */
+#ifndef NOTIFICATION_ENABLE_TRACE
+#define NOTIFICATION_ENABLE_TRACE 0
+#endif
+
+/**
+ * @brief Events kept in the trace ring, a power of two
+ *
+ * Each event takes 12 bytes; the oldest is overwritten once the ring is full.
+ */
+#ifndef NOTIFICATION_TRACE_EVENTS
+#define NOTIFICATION_TRACE_EVENTS 256
+#endif
+
+/**
+ * @brief Also emit every trace event to SEGGER SystemView
+ *
+ * Needs the app_trace component with CONFIG_APPTRACE_SV_ENABLE.
+ */
+#ifndef NOTIFICATION_TRACE_SYSVIEW
+#define NOTIFICATION_TRACE_SYSVIEW 0
+#endif
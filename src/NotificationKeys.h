@@ -0,0 +1,142 @@
+#pragma once
+
+#include <new>
+#include <optional>
+#include <type_traits>
+#include "Notification.h"
+
+/**
+ * @brief A key declared at compile time together with its payload type
+ * 
+ * Its handle is a constant, the key's home slot, and it converts to
+ * NotificationKey so it works with every handle based overload. send() and
+ * consume() only accept the declared type: pointer types travel as void* like
+ * send(key, void*), everything else by value like sendValue().
+ * 
+ * Declare keys with NOTIFY_KEY_TABLE() and install the table once at startup.
+ */
+template <typename T>
+struct NotificationStaticKey {
+    static_assert(std::is_pointer<T>::value ||
+                  (std::is_trivially_copyable<T>::value && sizeof(T) <= NOTIFICATION_INLINE_PAYLOAD_SIZE),
+                  "Key payloads must be pointers or trivially copyable values of at most "
+                  "NOTIFICATION_INLINE_PAYLOAD_SIZE bytes");
+    
+    using Type = T;
+    
+    const char* name;
+    uint32_t hash;
+    
+    constexpr NotificationKey handle() const { return NotificationKey{notificationHomeSlot(hash)}; }
+    constexpr operator NotificationKey() const { return handle(); }
+    
+    /**
+     * @brief Send a payload of the declared type
+     * 
+     * @return true if sent successfully, false otherwise
+     */
+    template <typename U>
+    bool send(Notification& notification, const U& value) const {
+        static_assert(std::is_same<std::decay_t<U>, T>::value, "Payload type doesn't match the key's declared type");
+        if constexpr (std::is_pointer<T>::value) {
+            return notification.send(handle(), (void*)value);
+        } else {
+            return notification.sendValue(handle(), &value, sizeof(T));
+        }
+    }
+    
+    /**
+     * @brief Consume the next payload
+     * 
+     * @param timeout_ticks Timeout in ticks to wait for a payload
+     * @return The payload, or std::nullopt on timeout
+     */
+    std::optional<T> consume(Notification& notification, TickType_t timeout_ticks = pdMS_TO_TICKS(100)) const {
+        if constexpr (std::is_pointer<T>::value) {
+            void* data = notification.consume(handle(), timeout_ticks);
+            if (data == nullptr) {
+                return std::nullopt;
+            }
+            return static_cast<T>(data);
+        } else {
+            // Raw storage, T only has to be trivially copyable, not default constructible
+            alignas(T) unsigned char bytes[sizeof(T)];
+            if (!notification.consumeValue(handle(), bytes, sizeof(T), timeout_ticks)) {
+                return std::nullopt;
+            }
+            return *std::launder(reinterpret_cast<const T*>(bytes));
+        }
+    }
+};
+
+/**
+ * @brief Check that every name fits in a slot, for NOTIFY_KEY_TABLE()
+ */
+constexpr bool notificationKeysFit(const NotificationKeyInfo* keys, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        size_t length = 0;
+        while (keys[i].name[length] != '\0') {
+            length++;
+        }
+        if (length >= NOTIFICATION_KEY_MAX_LEN) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Check that no two keys share a home slot, for NOTIFY_KEY_TABLE()
+ */
+constexpr bool notificationKeysDistinct(const NotificationKeyInfo* keys, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
+            if (notificationHomeSlot(keys[i].hash) == notificationHomeSlot(keys[j].hash)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Declare one typed key named after its identifier
+ */
+#define NOTIFY_KEY(name, type) \
+    static constexpr NotificationStaticKey<type> name{#name, notificationHash(#name)};
+
+#define NOTIFY_KEY_INFO_(name, type) NotificationKeyInfo{#name, notificationHash(#name)},
+
+/**
+ * @brief Declare a struct of typed keys with constant handles
+ * 
+ * KEYS is an X-macro that lists the keys as KEY(name, type). Hashes and slots
+ * are computed by the compiler, which also rejects names that are too long and
+ * keys that would share a slot. Call install() once at startup, before string
+ * keys are sent, then use the keys without any lookup.
+ * 
+ * @code
+ * #define APP_KEYS(KEY) \
+ *     KEY(temperature, float) \
+ *     KEY(humidity, float) \
+ *     KEY(raw_buffer, uint8_t*)
+ * 
+ * NOTIFY_KEY_TABLE(AppKeys, APP_KEYS);
+ * 
+ * AppKeys::install(*notification);
+ * AppKeys::temperature.send(*notification, 23.5f);
+ * std::optional<float> t = AppKeys::temperature.consume(*notification);
+ * notification->wait(AppKeys::humidity);
+ * @endcode
+ */
+#define NOTIFY_KEY_TABLE(table, KEYS) \
+    struct table { \
+        KEYS(NOTIFY_KEY) \
+        static constexpr NotificationKeyInfo keys[] = { KEYS(NOTIFY_KEY_INFO_) }; \
+        static constexpr size_t count = sizeof(keys) / sizeof(keys[0]); \
+        static_assert(notificationKeysFit(keys, count), \
+                      #table ": a key name is longer than NOTIFICATION_KEY_MAX_LEN - 1"); \
+        static_assert(notificationKeysDistinct(keys, count), \
+                      #table ": two keys share a slot, rename one or change NOTIFICATION_MAX_KEYS"); \
+        static bool install(Notification& notification) { return notification.installKeys(keys, count); } \
+    }
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_heap_caps.h"
+#include "NotificationConfig.h"
+
+/**
+ * @brief Heap placement policy shared by Notification and NotificationPool
+ * 
+ * Allocations of at least NOTIFICATION_PSRAM_THRESHOLD bytes go to PSRAM and
+ * everything smaller stays in internal RAM. When PSRAM is missing or full the
+ * allocation falls back to internal RAM, so the policy is safe on any board.
+ */
+
+/**
+ * @brief heap_caps_malloc() capabilities the policy picks for an allocation
+ */
+inline uint32_t notificationCaps(size_t bytes) {
+#if NOTIFICATION_PSRAM_THRESHOLD > 0
+    if (bytes >= (size_t)NOTIFICATION_PSRAM_THRESHOLD) {
+        return MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+    }
+#else
+    (void)bytes;
+#endif
+    return MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+}
+
+/**
+ * @brief Allocate by the placement policy, release with heap_caps_free()
+ * 
+ * @param caps Explicit capabilities, or 0 to let notificationCaps() decide
+ * @return Memory, or nullptr if neither the chosen region nor internal RAM has room
+ */
+inline void* notificationMalloc(size_t bytes, uint32_t caps = 0) {
+    void* memory = heap_caps_malloc(bytes, caps != 0 ? caps : notificationCaps(bytes));
+    if (memory == nullptr && caps == 0 && (notificationCaps(bytes) & MALLOC_CAP_SPIRAM)) {
+        memory = heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    return memory;
+}
@@ -0,0 +1,105 @@
+#include "NotificationPool.h"
+#include <string.h>
+#include "esp_attr.h"
+
+const char* NotificationPool::TAG = "NotificationPool";
+
+NotificationPool::NotificationPool(size_t block_size, size_t block_count, uint32_t caps)
+    : slab(nullptr), stride(0), blocks(0), freeList(nullptr), freeTop(0), refs(nullptr) {
+    if (block_size == 0 || block_count == 0 || block_count > UINT16_MAX) {
+        ESP_LOGE(TAG, "Invalid pool - block size: %zu, count: %zu", block_size, block_count);
+        return;
+    }
+    
+    // Keep every block 4-byte aligned
+    stride = (block_size + 3) & ~(size_t)3;
+    slab = (uint8_t*)notificationMalloc(stride * block_count, caps);
+    // Touched by acquire()/release() from ISRs, so never in PSRAM
+    freeList = (uint16_t*)heap_caps_malloc(block_count * sizeof(uint16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    refs = (uint8_t*)heap_caps_malloc(block_count, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    
+    if (slab == nullptr || freeList == nullptr || refs == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate pool - %zu x %zu bytes", block_count, stride);
+        heap_caps_free(slab);
+        heap_caps_free(freeList);
+        heap_caps_free(refs);
+        slab = nullptr;
+        freeList = nullptr;
+        refs = nullptr;
+        return;
+    }
+    
+    blocks = block_count;
+    for (size_t i = 0; i < blocks; i++) {
+        freeList[i] = (uint16_t)(blocks - 1 - i);
+    }
+    freeTop = blocks;
+    memset(refs, 0, blocks);
+    
+    ESP_LOGI(TAG, "Pool initialized - %zu x %zu bytes", blocks, stride);
+}
+
+NotificationPool::~NotificationPool() {
+    heap_caps_free(slab);
+    heap_caps_free(freeList);
+    heap_caps_free(refs);
+}
+
+void* IRAM_ATTR NotificationPool::acquire() {
+    void* block = nullptr;
+    
+    portENTER_CRITICAL_SAFE(&lock);
+    if (freeTop > 0) {
+        size_t index = freeList[--freeTop];
+        refs[index] = 1;
+        block = slab + index * stride;
+    }
+    portEXIT_CRITICAL_SAFE(&lock);
+    
+    return block;
+}
+
+bool IRAM_ATTR NotificationPool::retain(void* block) {
+    if (!owns(block)) {
+        return false;
+    }
+    
+    size_t index = indexOf(block);
+    portENTER_CRITICAL_SAFE(&lock);
+    // A dropped reference would free the block under a holder, so saturation fails instead
+    bool retained = refs[index] > 0 && refs[index] < UINT8_MAX;
+    if (retained) {
+        refs[index]++;
+    }
+    portEXIT_CRITICAL_SAFE(&lock);
+    return retained;
+}
+
+void IRAM_ATTR NotificationPool::release(void* block) {
+    if (!owns(block)) {
+        return;
+    }
+    
+    size_t index = indexOf(block);
+    portENTER_CRITICAL_SAFE(&lock);
+    if (refs[index] > 0 && --refs[index] == 0) {
+        freeList[freeTop++] = (uint16_t)index;
+    }
+    portEXIT_CRITICAL_SAFE(&lock);
+}
+
+bool IRAM_ATTR NotificationPool::owns(const void* ptr) const {
+    const uint8_t* p = (const uint8_t*)ptr;
+    return slab != nullptr && p >= slab && p < slab + stride * blocks;
+}
+
+size_t NotificationPool::available() {
+    portENTER_CRITICAL_SAFE(&lock);
+    size_t count = freeTop;
+    portEXIT_CRITICAL_SAFE(&lock);
+    return count;
+}
+
+size_t IRAM_ATTR NotificationPool::indexOf(const void* block) const {
+    return (size_t)((const uint8_t*)block - slab) / stride;
+}
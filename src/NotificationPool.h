@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "NotificationMemory.h"
+
+/**
+ * @brief Fixed-size payload blocks with reference counts
+ * 
+ * The whole slab is allocated once in the constructor, in internal RAM or PSRAM
+ * depending on caps. The free list and reference counts always stay in internal
+ * RAM. acquire(), retain() and release() never touch the heap and are safe from
+ * tasks and ISRs; they live in IRAM, so that includes ISRs that run with the flash
+ * cache disabled.
+ * 
+ * Ownership of an acquired block moves with it: producer -> Notification -> consumer.
+ * Attach the pool with Notification::attachPool() and blocks that are overwritten,
+ * removed, cleared or rejected by send() are released automatically.
+ */
+class NotificationPool {
+private:
+    uint8_t* slab;
+    size_t stride;
+    size_t blocks;
+    uint16_t* freeList;
+    size_t freeTop;
+    uint8_t* refs;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    
+    static const char* TAG;
+    
+    size_t indexOf(const void* block) const;
+    
+public:
+    /**
+     * @brief Constructor - allocates the slab
+     * 
+     * @param block_size Usable bytes per block
+     * @param block_count Number of blocks, up to 65535
+     * @param caps heap_caps_malloc() capabilities for the slab, e.g. MALLOC_CAP_SPIRAM,
+     *             or 0 to place it by NOTIFICATION_PSRAM_THRESHOLD
+     */
+    NotificationPool(size_t block_size, size_t block_count, uint32_t caps = 0);
+    
+    /**
+     * @brief Destructor - frees the slab, outstanding blocks become invalid
+     */
+    ~NotificationPool();
+    
+    /**
+     * @brief Take a free block with a reference count of 1
+     * 
+     * @return Block pointer, or nullptr if the pool is exhausted
+     */
+    void* acquire();
+    
+    /**
+     * @brief Add a reference, e.g. before handing a block to a second owner
+     * 
+     * @return true if retained, false if the block isn't live or already has
+     *         255 references; the caller must not hand it on then
+     */
+    bool retain(void* block);
+    
+    /**
+     * @brief Drop a reference, the block returns to the pool at zero
+     */
+    void release(void* block);
+    
+    /**
+     * @brief Check whether a pointer is a block of this pool
+     */
+    bool owns(const void* ptr) const;
+    
+    size_t blockSize() const { return stride; }
+    size_t capacity() const { return blocks; }
+    size_t available();
+};
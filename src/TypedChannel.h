@@ -0,0 +1,81 @@
+#pragma once
+
+#include <new>
+#include <optional>
+#include <type_traits>
+#include "Notification.h"
+
+/**
+ * @brief Typed, by-value view of one notification key
+ * 
+ * Small trivially-copyable payloads are copied straight into the key's slot, so
+ * there is no heap or static buffer to keep alive and no pointer to chase.
+ * 
+ * @code
+ * struct SensorData { int id; float value; uint32_t timestamp; };
+ * TypedChannel<SensorData> sensor(*notification, "sensor_data");
+ * 
+ * sensor.send({1, 23.4f, 1000});
+ * if (auto reading = sensor.consume()) {
+ *     ESP_LOGI("Sensor", "value: %.1f", reading->value);
+ * }
+ * @endcode
+ */
+template <typename T>
+class TypedChannel {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "TypedChannel payloads are copied with memcpy and must be trivially copyable");
+    static_assert(sizeof(T) <= NOTIFICATION_INLINE_PAYLOAD_SIZE,
+                  "TypedChannel payload is larger than NOTIFICATION_INLINE_PAYLOAD_SIZE");
+    
+private:
+    Notification& notification;
+    NotificationKey key;
+    
+public:
+    /**
+     * @brief Constructor - registers the key
+     * 
+     * @param notification The notification system the key lives in
+     * @param key The notification key
+     */
+    TypedChannel(Notification& notification, const char* key)
+        : notification(notification), key(notification.registerKey(key)) {}
+    
+    /**
+     * @brief Check that the key was registered
+     */
+    bool valid() const { return key.valid(); }
+    
+    /**
+     * @brief Get the underlying key handle
+     */
+    NotificationKey handle() const { return key; }
+    
+    /**
+     * @brief Send a copy of value
+     * 
+     * @return true if sent successfully, false otherwise
+     */
+    bool send(const T& value) {
+        return notification.sendValue(key, &value, sizeof(T));
+    }
+    
+    /**
+     * @brief Consume the next value
+     * 
+     * @param timeout_ticks Timeout in ticks to wait for a value
+     * @return The value, or std::nullopt on timeout
+     */
+    std::optional<T> consume(TickType_t timeout_ticks = pdMS_TO_TICKS(100)) {
+        // Raw storage, T only has to be trivially copyable, not default constructible
+        alignas(T) unsigned char bytes[sizeof(T)];
+        if (!notification.consumeValue(key, bytes, sizeof(T), timeout_ticks)) {
+            return std::nullopt;
+        }
+        return *std::launder(reinterpret_cast<const T*>(bytes));
+    }
+    
+    bool has() { return notification.has(key); }
+    bool wait(TickType_t timeout_ticks = portMAX_DELAY) { return notification.wait(key, timeout_ticks); }
+};
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Convert Notification::dumpTrace() output to a Perfetto / chrome://tracing timeline.
+
+Usage:
+    idf.py monitor | tee monitor.log
+    python3 tools/notification_trace.py monitor.log > trace.json
+
+Open trace.json in https://ui.perfetto.dev. Every task gets a track: waits show
+as slices from "wait" to "wake", everything else, timeouts included, as instant
+events. Events from ISRs go on one track per core. Lines that don't start with
+"TRACE " are ignored, so a whole monitor log can be passed as is.
+"""
+
+import json
+import sys
+
+WRAP = 1 << 32
+
+
+def parse(lines):
+    """Yield (time_us, core, type, task, scope, name) with the 32-bit clock unwrapped."""
+    offset = 0
+    last = None
+    for line in lines:
+        start = line.find("TRACE ")
+        if start < 0:
+            continue
+        fields = line[start:].rstrip("\r\n").split(" ", 6)
+        if len(fields) < 7:
+            continue
+        _, time_us, core, kind, task, scope, name = fields
+        try:
+            time_us = int(time_us)
+            core = int(core)
+        except ValueError:
+            continue
+
+        if last is not None and time_us + offset < last - WRAP // 2:
+            offset += WRAP
+        last = time_us + offset
+
+        if task in ("(nil)", "0x0", "0"):
+            task = None
+        yield last, core, kind, task, scope, name
+
+
+def convert(events):
+    trace = []
+    tracks = {}
+
+    def track(task, core):
+        label = task if task is not None else "isr core %d" % core
+        if label not in tracks:
+            tracks[label] = len(tracks) + 1
+            trace.append({"ph": "M", "name": "thread_name", "pid": 1, "tid": tracks[label],
+                          "args": {"name": label if task is None else "task " + task}})
+        return tracks[label]
+
+    open_waits = {}
+    for time_us, core, kind, task, scope, name in events:
+        tid = track(task, core)
+        label = {"shard": "shard " + name, "any": "(any)"}.get(scope, name)
+        event = {"pid": 1, "tid": tid, "ts": time_us, "args": {"core": core, scope: name}}
+
+        if kind == "wait":
+            event.update(ph="B", name="wait " + label)
+            open_waits[tid] = True
+        elif kind == "wake":
+            if not open_waits.pop(tid, False):
+                # The matching wait fell out of the ring
+                continue
+            event.update(ph="E")
+        else:
+            event.update(ph="i", s="t", name=kind + " " + label)
+        trace.append(event)
+    return {"traceEvents": trace, "displayTimeUnit": "ms"}
+
+
+def main():
+    if len(sys.argv) > 2:
+        sys.exit(__doc__)
+    source = open(sys.argv[1], errors="replace") if len(sys.argv) == 2 else sys.stdin
+    with source:
+        json.dump(convert(parse(source)), sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()